@@ -0,0 +1,19 @@
+// y = c[0] + c[1] x + ... + c[degree] x^degree by Horner's method, in the same
+// order of operations as evaluatePolynomial() of main.cpp. The loop makes the
+// kernel compute-bound, so that the host and the device both have work to
+// contribute.
+__kernel void
+evaluatePolynomial(
+    __global float *y,
+    __global const float *x,
+    __constant float *coeffs,
+    uint degree)
+{
+  size_t i = get_global_id(0);
+  float xi = x[i];
+  float acc = coeffs[degree];
+  for (uint k = degree; k > 0; k--) {
+    acc = acc * xi + coeffs[k - 1];
+  }
+  y[i] = acc;
+}
@@ -0,0 +1,228 @@
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/aligned_allocator.hpp>
+#include <clstudy/co_execution.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/host_compute.hpp>
+#include <clstudy/program_cache.hpp>
+#include <clstudy/verify.hpp>
+
+
+namespace
+{
+
+constexpr cl_uint kDegree = 64;
+
+
+// Host version of evaluatePolynomial of kernel.cl for n elements.
+inline void
+evaluatePolynomial(
+  float* y,
+  const float* x,
+  const std::vector<float>& coeffs,
+  std::size_t n) noexcept
+{
+  for (std::size_t i = 0; i < n; i++) {
+    auto acc = coeffs[kDegree];
+    for (auto k = kDegree; k > 0; k--) {
+      acc = acc * x[i] + coeffs[k - 1];
+    }
+    y[i] = acc;
+  }
+}
+
+
+// Sub-buffer of the floats [begin, end) of buffer; begin has to meet the base
+// address alignment of the devices.
+inline cl::Buffer
+createChunkBuffer(cl::Buffer& buffer, std::size_t begin, std::size_t end)
+{
+  const cl_buffer_region region{sizeof(float) * begin, sizeof(float) * (end - begin)};
+  return buffer.createSubBuffer(0, CL_BUFFER_CREATE_TYPE_REGION, &region);
+}
+
+
+inline void
+printReport(const std::string& title, const clstudy::CoExecutionReport& report, std::size_t n)
+{
+  std::cout << title << ": " << report.seconds * 1.0e3 << " ms, "
+            << static_cast<double>(n) / report.seconds * 1.0e-6 << " Melem/s" << std::endl;
+  for (const auto& worker : report.workers) {
+    if (worker.nChunks == 0) {
+      continue;
+    }
+    std::cout << "  " << worker.name << ": "
+              << static_cast<double>(worker.nElements) * 100.0 / static_cast<double>(n) << " % in "
+              << worker.nChunks << " chunks, "
+              << worker.elementsPerSecond() * 1.0e-6 << " Melem/s" << std::endl;
+  }
+}
+
+}  // namespace
+
+
+int
+main()
+{
+  constexpr std::size_t kAlignment = 4096;
+  constexpr std::size_t kDataSize = 1 << 24;
+  constexpr auto kRuns = 4;
+  // Host and device may or may not contract the steps of Horner's method.
+  constexpr auto kRelativeEps = 1.0e-5f;
+
+  try {
+    std::cout << "Get platforms" << std::endl;
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0) {
+      std::cerr << "Platform not found" << std::endl;
+      return -1;
+    }
+
+    cl_context_properties properties[] = {
+      CL_CONTEXT_PLATFORM,
+      reinterpret_cast<cl_context_properties>((platforms[0])()),
+      0
+    };
+    std::cout << "Create context" << std::endl;
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
+
+    std::cout << "Get devices" << std::endl;
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+    std::cout << "Build program" << std::endl;
+    auto program = clstudy::buildProgramFromFile("kernel", context, devices);
+
+    clstudy::HostCompute hostCompute;
+    std::cout << "Host: " << hostCompute.describe() << std::endl;
+
+    std::cout << "Initialize host buffers" << std::endl;
+    using HostVector = std::vector<float, clstudy::UninitializedAllocator<float, kAlignment>>;
+    HostVector hostX(kDataSize);
+    hostCompute.generate(hostX.data(), hostX.size(), [](std::size_t i) {
+      return static_cast<float>(i % 1024) / 1024.0f;
+    });
+    HostVector hostY(kDataSize);
+    HostVector expected(kDataSize);
+    hostCompute.generate(expected.data(), expected.size(), [](std::size_t) {
+      return 0.0f;
+    });
+    std::vector<float> coeffs(kDegree + 1);
+    for (std::size_t k = 0; k < coeffs.size(); k++) {
+      coeffs[k] = 1.0f / static_cast<float>(k + 1);
+    }
+
+    // The host and the devices work on the host buffers directly. Every chunk
+    // of y is a sub-buffer of its own, which is synchronized by mapping,
+    // without copying y as a whole.
+    std::cout << "Bind host buffers to device buffers" << std::endl;
+    cl::Buffer deviceX{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+      sizeof(decltype(hostX)::value_type) * hostX.size(),
+      hostX.data()};
+    cl::Buffer deviceY{
+      context,
+      CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
+      sizeof(decltype(hostY)::value_type) * hostY.size(),
+      hostY.data()};
+    cl::Buffer deviceCoeffs{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(decltype(coeffs)::value_type) * coeffs.size(),
+      coeffs.data()};
+
+    // cl::Kernel::setArg() is not thread-safe, so every device thread gets
+    // its own kernel.
+    std::vector<cl::Kernel> kernels;
+    for (std::size_t d = 0; d < devices.size(); d++) {
+      kernels.emplace_back(program, "evaluatePolynomial");
+      kernels.back().setArg(2, deviceCoeffs);
+      kernels.back().setArg(3, kDegree);
+    }
+    // Maps the chunks of the host, and y as a whole between runs
+    cl::CommandQueue hostQueue{context, devices[0]};
+
+    const auto hostWork = [&](std::size_t begin, std::size_t end) {
+      auto chunkY = createChunkBuffer(deviceY, begin, end);
+      const auto y = static_cast<float*>(hostQueue.enqueueMapBuffer(
+        chunkY,
+        CL_TRUE,
+        CL_MAP_WRITE_INVALIDATE_REGION,
+        0,
+        sizeof(float) * (end - begin)));
+      hostCompute.parallelFor(end - begin, [&](std::size_t first, std::size_t last) {
+        evaluatePolynomial(y + first, hostX.data() + begin + first, coeffs, last - first);
+      });
+      cl::Event event;
+      hostQueue.enqueueUnmapMemObject(chunkY, y, nullptr, &event);
+      event.wait();
+    };
+    const auto deviceWork = [&](std::size_t d, cl::CommandQueue& queue, std::size_t begin, std::size_t end) {
+      const auto chunkX = createChunkBuffer(deviceX, begin, end);
+      auto chunkY = createChunkBuffer(deviceY, begin, end);
+      kernels[d].setArg(0, chunkY);
+      kernels[d].setArg(1, chunkX);
+      queue.enqueueNDRangeKernel(
+        kernels[d],
+        cl::NullRange,
+        cl::NDRange{end - begin},
+        cl::NullRange);
+      const auto ptr = queue.enqueueMapBuffer(
+        chunkY,
+        CL_FALSE,
+        CL_MAP_READ,
+        0,
+        sizeof(float) * (end - begin));
+      cl::Event event;
+      queue.enqueueUnmapMemObject(chunkY, ptr, nullptr, &event);
+      return event;
+    };
+
+    std::cout << "Compute expected results on host" << std::endl;
+    hostCompute.parallelFor(kDataSize, [&](std::size_t begin, std::size_t end) {
+      evaluatePolynomial(expected.data() + begin, hostX.data() + begin, coeffs, end - begin);
+    });
+
+    auto isAllOk = true;
+    clstudy::ResultVerifier verifier{hostCompute, clstudy::Tolerance::relative(kRelativeEps)};
+    const auto verify = [&] {
+      std::cout << "  Verify calculation results... ";
+      const auto& report = verifier.verifyBuffer(hostQueue, deviceY, expected.data(), kDataSize);
+      std::cout << (report.isOk() ? "OK" : "NG") << std::endl;
+      clstudy::printMismatches(std::cout, report);
+      isAllOk &= report.isOk();
+    };
+
+    using Scheduler = clstudy::CoExecutionScheduler;
+    Scheduler scheduler{context, devices, Scheduler::getSubBufferGrainSize(devices, sizeof(float))};
+    // The first runs of each mode measure the throughputs the later ones use.
+    const auto runAndVerify = [&](const std::string& title, const Scheduler::HostWork& hostWorkOfMode, const Scheduler::DeviceWork& deviceWorkOfMode) {
+      hostQueue.enqueueFillBuffer(deviceY, 0.0f, 0, sizeof(float) * kDataSize);
+      hostQueue.finish();
+      for (auto i = 0; i < kRuns; i++) {
+        printReport(title + ", run " + std::to_string(i + 1), scheduler.run(kDataSize, hostWorkOfMode, deviceWorkOfMode), kDataSize);
+      }
+      verify();
+    };
+    runAndVerify("Host only", hostWork, nullptr);
+    runAndVerify("Devices only", nullptr, deviceWork);
+    runAndVerify("Host and devices", hostWork, deviceWork);
+
+    if (!isAllOk) {
+      return 1;
+    }
+  } catch (const cl::Error& ex) {
+    std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
+    return 1;
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,83 @@
+// Sum of blocks of 2 * get_local_size(0) elements of input, one per work-group,
+// to output[get_group_id(0)]. When the work-group is the only one, the sum is
+// the total and goes to *result instead. The local size must be a power of two.
+void
+reduceBlocks(
+    __global const float *input,
+    __global float *output,
+    __global float *result,
+    __local float *scratch,
+    uint n)
+{
+  const uint lid = get_local_id(0);
+  const uint i = get_group_id(0) * get_local_size(0) * 2 + lid;
+  float sum = i < n ? input[i] : 0.0f;
+  if (i + get_local_size(0) < n) {
+    sum += input[i + get_local_size(0)];
+  }
+  scratch[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint offset = get_local_size(0) / 2; offset > 0; offset >>= 1) {
+    if (lid < offset) {
+      scratch[lid] += scratch[lid + offset];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (lid == 0) {
+    if (get_num_groups(0) == 1) {
+      *result = scratch[0];
+    } else {
+      output[get_group_id(0)] = scratch[0];
+    }
+  }
+}
+
+
+// One stage of the host-driven reduction; the host enqueues stages until a
+// single work-group is left.
+__kernel void
+reduceStage(
+    __global const float *input,
+    __global float *output,
+    __global float *result,
+    __local float *scratch,
+    uint n)
+{
+  reduceBlocks(input, output, result, scratch, n);
+}
+
+
+#if __OPENCL_C_VERSION__ >= 200 && (__OPENCL_C_VERSION__ < 300 || defined(__opencl_c_device_enqueue))
+// The same reduction, where each stage enqueues the next one on the default
+// device queue, so the host only launches the first one and waits once.
+// Stages alternate between output and spare, so input is left intact.
+__kernel void
+reduceDeviceEnqueue(
+    __global const float *input,
+    __global float *output,
+    __global float *spare,
+    __global float *result,
+    __local float *scratch,
+    uint n)
+{
+  reduceBlocks(input, output, result, scratch, n);
+
+  const uint nGroups = get_num_groups(0);
+  if (nGroups > 1 && get_global_id(0) == 0) {
+    const size_t localSize = get_local_size(0);
+    const size_t nNextGroups = (nGroups + localSize * 2 - 1) / (localSize * 2);
+    // CLK_ENQUEUE_FLAGS_WAIT_KERNEL starts the child after every work-item of
+    // this kernel has finished writing output.
+    enqueue_kernel(
+      get_default_queue(),
+      CLK_ENQUEUE_FLAGS_WAIT_KERNEL,
+      ndrange_1D(nNextGroups * localSize, localSize),
+      ^(__local void *childScratch) {
+        reduceDeviceEnqueue(output, spare, output, result, (__local float *)childScratch, nGroups);
+      },
+      (uint)(sizeof(float) * localSize));
+  }
+}
+#endif  // __OPENCL_C_VERSION__ >= 200 && (__OPENCL_C_VERSION__ < 300 || defined(__opencl_c_device_enqueue))
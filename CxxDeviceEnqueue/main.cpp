@@ -0,0 +1,223 @@
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/program_cache.hpp>
+
+
+namespace
+{
+
+/*!
+ * Average elapsed milliseconds of kRepeats calls of run after a warm-up, and
+ * the result of the last call.
+ */
+template<typename F>
+inline std::pair<double, float>
+measureMilliseconds(F run)
+{
+  constexpr auto kRepeats = 10;
+
+  auto result = run();
+  const auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kRepeats; i++) {
+    result = run();
+  }
+  const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  return {elapsed / kRepeats, result};
+}
+
+
+inline std::size_t
+calcNumGroups(std::size_t n, std::size_t localSize) noexcept
+{
+  return (n + localSize * 2 - 1) / (localSize * 2);
+}
+
+
+inline float
+readResult(cl::CommandQueue& queue, const cl::Buffer& deviceResult)
+{
+  float result = 0.0f;
+  queue.enqueueReadBuffer(deviceResult, CL_TRUE, 0, sizeof(result), &result);
+  return result;
+}
+
+
+inline bool
+verify(double expected, float actual)
+{
+  constexpr auto kRelativeEps = 1.0e-4;
+
+  std::cout << "  Verify calculation result (host: " << expected << ", device: " << actual << ")... ";
+  const auto verifyResult = std::abs(static_cast<double>(actual) - expected) <= kRelativeEps * std::abs(expected);
+  std::cout << (verifyResult ? "OK" : "NG") << std::endl;
+  return verifyResult;
+}
+
+}  // namespace
+
+
+int
+main()
+{
+  constexpr std::size_t kDataSize = 1 << 24;
+
+  try {
+    std::cout << "Get platforms" << std::endl;
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0) {
+      std::cerr << "Platform not found" << std::endl;
+      return -1;
+    }
+
+    cl_context_properties properties[] = {
+      CL_CONTEXT_PLATFORM,
+      reinterpret_cast<cl_context_properties>((platforms[0])()),
+      0
+    };
+    std::cout << "Create context" << std::endl;
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
+
+    std::cout << "Get devices" << std::endl;
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    const auto& device = devices[0];
+
+    const auto isDeviceEnqueueSupported = std::all_of(
+      std::cbegin(devices),
+      std::cend(devices),
+      [](const auto& d) {
+        return clstudy::isDeviceEnqueueSupported(d);
+      });
+    std::cout << "Device-side enqueue: " << (isDeviceEnqueueSupported ? "supported" : "not supported") << std::endl;
+
+    std::cout << "Build program" << std::endl;
+    auto program = clstudy::buildProgramFromFile(
+      "kernel",
+      context,
+      devices,
+      isDeviceEnqueueSupported ? "-cl-std=CL2.0" : "");
+    cl::Kernel stageKernel{program, "reduceStage"};
+
+    // The tree reduction needs a power-of-two local size.
+    const auto maxLocalSize = std::min<std::size_t>(
+      stageKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+      256);
+    std::size_t localSize = 1;
+    while (localSize * 2 <= maxLocalSize) {
+      localSize *= 2;
+    }
+    std::size_t nStages = 1;
+    for (auto n = kDataSize; calcNumGroups(n, localSize) > 1; n = calcNumGroups(n, localSize)) {
+      nStages++;
+    }
+    std::cout << "Reduce " << kDataSize << " elements in " << nStages
+              << " stages with work-groups of " << localSize << std::endl;
+
+    std::cout << "Initialize host buffer" << std::endl;
+    std::mt19937 engine{0};
+    std::uniform_real_distribution<float> dist{0.0f, 1.0f};
+    std::vector<float> hostData(kDataSize);
+    std::generate(std::begin(hostData), std::end(hostData), [&] {
+      return dist(engine);
+    });
+    auto expected = 0.0;
+    for (const auto& x : hostData) {
+      expected += static_cast<double>(x);
+    }
+
+    std::cout << "Allocate device buffers" << std::endl;
+    cl::Buffer deviceData{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(decltype(hostData)::value_type) * hostData.size(),
+      hostData.data()};
+    // Partial sums of the stages, alternately
+    const auto nFirstGroups = calcNumGroups(kDataSize, localSize);
+    cl::Buffer devicePing{context, CL_MEM_READ_WRITE, sizeof(float) * nFirstGroups};
+    cl::Buffer devicePong{context, CL_MEM_READ_WRITE, sizeof(float) * nFirstGroups};
+    cl::Buffer deviceResult{context, CL_MEM_WRITE_ONLY, sizeof(float)};
+
+    std::cout << "Create command queue" << std::endl;
+    cl::CommandQueue queue{context, device};
+
+    auto isAllOk = true;
+
+    const auto hostDriven = measureMilliseconds([&] {
+      auto src = deviceData;
+      auto dst = devicePing;
+      auto spare = devicePong;
+      auto n = kDataSize;
+      for (;;) {
+        const auto nGroups = calcNumGroups(n, localSize);
+        stageKernel.setArg(0, src);
+        stageKernel.setArg(1, dst);
+        stageKernel.setArg(2, deviceResult);
+        stageKernel.setArg(3, cl::Local(sizeof(float) * localSize));
+        stageKernel.setArg(4, static_cast<cl_uint>(n));
+        queue.enqueueNDRangeKernel(
+          stageKernel,
+          cl::NullRange,
+          cl::NDRange{nGroups * localSize},
+          cl::NDRange{localSize});
+        if (nGroups == 1) {
+          break;
+        }
+        n = nGroups;
+        src = dst;
+        std::swap(dst, spare);
+      }
+      return readResult(queue, deviceResult);
+    });
+    std::cout << "Host-driven multi-pass: " << hostDriven.first << " ms" << std::endl;
+    isAllOk &= verify(expected, hostDriven.second);
+
+    if (isDeviceEnqueueSupported) {
+      // enqueue_kernel() uses the default device queue of the device.
+      const auto deviceQueue = cl::DeviceCommandQueue::makeDefault(context, device);
+      std::cout << "Create default device queue of " << deviceQueue.getInfo<CL_QUEUE_SIZE>() << " bytes" << std::endl;
+      cl::Kernel enqueueKernel{program, "reduceDeviceEnqueue"};
+      enqueueKernel.setArg(0, deviceData);
+      enqueueKernel.setArg(1, devicePing);
+      enqueueKernel.setArg(2, devicePong);
+      enqueueKernel.setArg(3, deviceResult);
+      enqueueKernel.setArg(4, cl::Local(sizeof(float) * localSize));
+      enqueueKernel.setArg(5, static_cast<cl_uint>(kDataSize));
+
+      const auto deviceDriven = measureMilliseconds([&] {
+        // The kernel completes only after the stages it enqueued.
+        queue.enqueueNDRangeKernel(
+          enqueueKernel,
+          cl::NullRange,
+          cl::NDRange{nFirstGroups * localSize},
+          cl::NDRange{localSize});
+        return readResult(queue, deviceResult);
+      });
+      std::cout << "Device-side enqueue: " << deviceDriven.first << " ms ("
+                << hostDriven.first / deviceDriven.first << "x)" << std::endl;
+      isAllOk &= verify(expected, deviceDriven.second);
+    } else {
+      std::cout << "Device-side enqueue: skipped" << std::endl;
+    }
+
+    if (!isAllOk) {
+      return 1;
+    }
+  } catch (const cl::Error& ex) {
+    std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
+    return 1;
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+}
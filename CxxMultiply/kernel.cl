@@ -7,3 +7,132 @@ innerProduct(
   int i = get_global_id(0);
   c[i] = a[i] * b[i];
 }
+
+
+// fp16 storage with fp32 arithmetic. vload_half and vstore_half are core
+// built-ins, so this does not need cl_khr_fp16.
+__kernel void
+innerProductHalf(
+    __global half *c,
+    __global const half *a,
+    __global const half *b,
+    uint size)
+{
+  const uint i = get_global_id(0);
+  if (i < size) {
+    vstore_half(vload_half(i, a) * vload_half(i, b), i, c);
+  }
+}
+
+
+// Grid-stride loop: any number of work-items covers any size, so the launch
+// can be sized to the device rather than to the data.
+__kernel void
+innerProductGridStride(
+    __global float *c,
+    __global const float *a,
+    __global const float *b,
+    uint size)
+{
+  for (uint i = get_global_id(0); i < size; i += get_global_size(0)) {
+    c[i] = a[i] * b[i];
+  }
+}
+
+
+// innerProductN processes N floats per work-item and needs ceil(size / N)
+// work-items. The last work-item finishes the remainder one by one when size
+// is not a multiple of N.
+#define DEFINE_INNER_PRODUCT_VECTOR(N) \
+__kernel void \
+innerProduct ## N( \
+    __global float *c, \
+    __global const float *a, \
+    __global const float *b, \
+    uint size) \
+{ \
+  const uint i = get_global_id(0); \
+  const uint offset = i * N; \
+  if (offset + N <= size) { \
+    vstore ## N(vload ## N(i, a) * vload ## N(i, b), i, c); \
+  } else { \
+    for (uint j = offset; j < size; j++) { \
+      c[j] = a[j] * b[j]; \
+    } \
+  } \
+}
+
+DEFINE_INNER_PRODUCT_VECTOR(2)
+DEFINE_INNER_PRODUCT_VECTOR(4)
+DEFINE_INNER_PRODUCT_VECTOR(8)
+DEFINE_INNER_PRODUCT_VECTOR(16)
+
+
+// Inner product of a and b, reduced within each work-group.
+// Every work-item first accumulates a grid-strided slice, then the work-group
+// sums up the slices in scratch (the local size must be a power of two) and
+// writes one partial sum per group; the caller adds up the partial sums.
+__kernel void
+dotProductPartial(
+    __global float *partialSums,
+    __global const float *a,
+    __global const float *b,
+    __local float *scratch,
+    uint size)
+{
+  const uint lid = get_local_id(0);
+  float sum = 0.0f;
+  for (uint i = get_global_id(0); i < size; i += get_global_size(0)) {
+    sum += a[i] * b[i];
+  }
+  scratch[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if (lid < s) {
+      scratch[lid] += scratch[lid + s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid == 0) {
+    partialSums[get_group_id(0)] = scratch[0];
+  }
+}
+
+
+#if defined(cl_khr_subgroups) && __OPENCL_C_VERSION__ >= 200
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+
+// Same as dotProductPartial, but each sub-group reduces in registers first,
+// so scratch only holds one value per sub-group (get_num_sub_groups() floats)
+// and a single barrier is needed. Requires -cl-std=CL2.0.
+__kernel void
+dotProductPartialSubGroup(
+    __global float *partialSums,
+    __global const float *a,
+    __global const float *b,
+    __local float *scratch,
+    uint size)
+{
+  float sum = 0.0f;
+  for (uint i = get_global_id(0); i < size; i += get_global_size(0)) {
+    sum += a[i] * b[i];
+  }
+  sum = sub_group_reduce_add(sum);
+  if (get_sub_group_local_id() == 0) {
+    scratch[get_sub_group_id()] = sum;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if (get_sub_group_id() == 0) {
+    float total = 0.0f;
+    for (uint i = get_sub_group_local_id(); i < get_num_sub_groups(); i += get_sub_group_size()) {
+      total += scratch[i];
+    }
+    total = sub_group_reduce_add(total);
+    if (get_sub_group_local_id() == 0) {
+      partialSums[get_group_id(0)] = total;
+    }
+  }
+}
+#endif  // defined(cl_khr_subgroups) && __OPENCL_C_VERSION__ >= 200
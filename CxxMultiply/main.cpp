@@ -1,107 +1,338 @@
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <chrono>
-#include <fstream>
+#include <future>
 #include <iostream>
 #include <iterator>
 #include <numeric>
+#include <stdexcept>
 #include <vector>
 #include <string>
 
 #include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/half.hpp>
+#include <clstudy/host_compute.hpp>
+#include <clstudy/program_cache.hpp>
+#include <clstudy/sub_group.hpp>
+#include <clstudy/thread_pool.hpp>
+#include <clstudy/verify.hpp>
+#include <clstudy/work_group_tuner.hpp>
 
 
 namespace
 {
 
-inline std::string
-removeSuffix(const std::string& filename) noexcept
+/*!
+ * Create innerProduct<width> (innerProduct for 1), or the next narrower one
+ * when program lacks it. width is updated to that of the created kernel.
+ */
+inline cl::Kernel
+createInnerProductKernel(const cl::Program& program, cl_uint& width)
 {
-  return filename.substr(0, filename.find_last_of("."));
+  for (; width > 1; width /= 2) {
+    try {
+      return cl::Kernel{program, ("innerProduct" + std::to_string(width)).c_str()};
+    } catch (const cl::Error& ex) {
+      std::cerr << "innerProduct" << width << " is not available: "
+                << ex.what() << "(" << ex.err() << ")" << std::endl;
+    }
+  }
+  return cl::Kernel{program, "innerProduct"};
 }
 
 
-inline std::size_t
-getStreamSize(std::istream& is) noexcept
+enum class Mode
+{
+  // Elementwise product, c[i] = a[i] * b[i]
+  kMultiply,
+  // Inner product, sum(a[i] * b[i])
+  kDotProduct,
+  // Elementwise product with fp16 buffers and fp32 arithmetic
+  kHalfMultiply
+};
+
+
+/*!
+ * Mode selected by the environment variable CLSTUDY_MODE, which is one of
+ * "multiply" (default), "dot" and "half".
+ */
+inline Mode
+getModeFromEnv()
 {
-  const auto currentPos = is.tellg();
-  is.seekg(0, std::ifstream::end);
-  const auto endPos = is.tellg();
-  is.seekg(currentPos, std::ifstream::beg);
-  return static_cast<std::size_t>(endPos - currentPos);
+  const auto value = std::getenv("CLSTUDY_MODE");
+  if (value == nullptr || value[0] == '\0') {
+    return Mode::kMultiply;
+  }
+
+  const std::string name{value};
+  if (name == "multiply") {
+    return Mode::kMultiply;
+  } else if (name == "dot") {
+    return Mode::kDotProduct;
+  } else if (name == "half") {
+    return Mode::kHalfMultiply;
+  }
+  throw std::runtime_error{"Unknown CLSTUDY_MODE: " + name};
 }
 
 
-inline std::vector<unsigned char>
-readBinaryAll(std::ifstream& ifs) noexcept
+/*!
+ * Whether the environment variable CLSTUDY_LAUNCH is "grid-stride", which
+ * launches innerProductGridStride with CL_DEVICE_MAX_COMPUTE_UNITS x occupancy
+ * factor work-groups instead of one work-item per element ("per-element",
+ * default).
+ */
+inline bool
+isGridStrideLaunchFromEnv()
 {
-  std::vector<unsigned char> binary(getStreamSize(ifs));
-  ifs.read(reinterpret_cast<char*>(&binary[0]), binary.size());
-  return binary;
+  const auto value = std::getenv("CLSTUDY_LAUNCH");
+  if (value == nullptr || value[0] == '\0') {
+    return false;
+  }
+
+  const std::string name{value};
+  if (name == "per-element") {
+    return false;
+  } else if (name == "grid-stride") {
+    return true;
+  }
+  throw std::runtime_error{"Unknown CLSTUDY_LAUNCH: " + name};
 }
 
 
-inline std::string
-readTextAll(std::ifstream& ifs) noexcept
+/*!
+ * Inner product of a and b with Neumaier's compensated summation, used as the
+ * reference of the device reduction.
+ */
+inline double
+compensatedInnerProduct(const std::vector<float>& a, const std::vector<float>& b) noexcept
 {
-  std::string text;
-  text.resize(getStreamSize(ifs));
-  ifs.read(&text[0], text.size());
-  return text;
+  auto sum = 0.0;
+  auto compensation = 0.0;
+  for (decltype(a.size()) i = 0; i < a.size(); i++) {
+    const auto x = static_cast<double>(a[i]) * static_cast<double>(b[i]);
+    const auto t = sum + x;
+    if (std::abs(sum) >= std::abs(x)) {
+      compensation += (sum - t) + x;
+    } else {
+      compensation += (x - t) + sum;
+    }
+    sum = t;
+  }
+  return sum + compensation;
 }
 
 
-inline cl::Program
-buildProgramFromFile(
-  const std::string& baseName,
+/*!
+ * Compute the inner product with dotProductPartialSubGroup, or dotProductPartial
+ * when the device has no sub-groups, which leave one partial sum per
+ * work-group, and add up the partial sums on the host.
+ */
+inline void
+runDotProduct(
   const cl::Context& context,
-  const std::vector<cl::Device>& devices,
-  bool saveBinary = true)
+  const cl::Device& device,
+  std::future<cl::Program>& programFuture,
+  const std::vector<float>& hostDataA,
+  const std::vector<float>& hostDataB)
 {
-  int cnt = 0;
-  std::vector<std::vector<unsigned char>> loadedBinaries;
-  do {
-    std::ifstream ifs{baseName + "." + std::to_string(cnt) + ".bc", std::ios::binary};
-    if (!ifs.is_open()) {
-      cnt = 0;
-      continue;
+  constexpr auto kRelativeEps = 1.0e-4;
+  constexpr std::size_t kMaxLocalSize = 256;
+
+  std::cout << "Inner product on host (compensated): ";
+  const auto start1 = std::chrono::high_resolution_clock::now();
+  const auto expected = compensatedInnerProduct(hostDataA, hostDataB);
+  const auto elapsed1 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start1).count();
+  std::cout << elapsed1 << " ms" << std::endl;
+
+  std::cout << "Wait for program build" << std::endl;
+  auto program = programFuture.get();
+
+  cl::Kernel kernel;
+  std::size_t localSize = 0;
+  // Number of floats of local memory the kernel needs
+  std::size_t scratchSize = 0;
+  if (clstudy::isSubGroupSupported(device)) {
+    try {
+      kernel = cl::Kernel{program, "dotProductPartialSubGroup"};
+      const auto launch = clstudy::chooseSubGroupLaunch(kernel, device, kMaxLocalSize);
+      localSize = launch.localSize;
+      scratchSize = launch.nSubGroups;
+      std::cout << "Use sub-groups of " << launch.subGroupSize << " work-items" << std::endl;
+    } catch (const cl::Error& ex) {
+      std::cerr << "dotProductPartialSubGroup is not available: "
+                << ex.what() << "(" << ex.err() << ")" << std::endl;
     }
-    loadedBinaries.emplace_back(readBinaryAll(ifs));
-  } while (cnt != 0);
-
-  if (loadedBinaries.size() > 0) {
-    cl::Program program(
-      context,
-      devices,
-      loadedBinaries);
-    program.build(devices);
-    return program;
   }
-
-  const auto sourceFileName = std::string{baseName + ".cl"};
-  std::ifstream ifs{sourceFileName};
-  if (!ifs.is_open()) {
-    throw std::runtime_error{"Failed to open: " + sourceFileName};
+  if (localSize == 0) {
+    kernel = cl::Kernel{program, "dotProductPartial"};
+    // The tree reduction needs a power-of-two local size.
+    const auto maxLocalSize = std::min<std::size_t>(
+      kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+      kMaxLocalSize);
+    localSize = 1;
+    while (localSize * 2 <= maxLocalSize) {
+      localSize *= 2;
+    }
+    scratchSize = localSize;
   }
-  cl::Program program = cl::Program(
-    context,
-    readTextAll(ifs));
-  program.build(devices);
+  // A few groups per compute unit are enough to saturate the device; the
+  // work-items stride over the rest of the data.
+  const std::size_t nGroups = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4;
+  std::cout << "Use " << nGroups << " work-groups of " << localSize << " work-items" << std::endl;
 
-  if (!saveBinary) {
-    return program;
+  cl::Buffer deviceDataA{
+    context,
+    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    sizeof(float) * hostDataA.size(),
+    const_cast<float*>(hostDataA.data())};
+  cl::Buffer deviceDataB{
+    context,
+    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    sizeof(float) * hostDataB.size(),
+    const_cast<float*>(hostDataB.data())};
+  cl::Buffer devicePartialSums{
+    context,
+    CL_MEM_WRITE_ONLY,
+    sizeof(float) * nGroups};
+  kernel.setArg(0, devicePartialSums);
+  kernel.setArg(1, deviceDataA);
+  kernel.setArg(2, deviceDataB);
+  kernel.setArg(3, cl::Local(sizeof(float) * scratchSize));
+  kernel.setArg(4, static_cast<cl_uint>(hostDataA.size()));
+
+  cl::CommandQueue queue{context, device};
+  std::cout << "Inner product on device: ";
+  const auto start2 = std::chrono::high_resolution_clock::now();
+  std::vector<float> partialSums(nGroups);
+  queue.enqueueNDRangeKernel(
+    kernel,
+    cl::NullRange,
+    cl::NDRange{nGroups * localSize},
+    cl::NDRange{localSize});
+  queue.enqueueReadBuffer(
+    devicePartialSums,
+    CL_TRUE,
+    0,
+    sizeof(float) * partialSums.size(),
+    partialSums.data());
+  auto actual = 0.0;
+  for (const auto& partialSum : partialSums) {
+    actual += static_cast<double>(partialSum);
   }
+  const auto elapsed2 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start2).count();
+  std::cout << elapsed2 << " ms" << std::endl;
+  std::cout << "Read back " << sizeof(float) * partialSums.size() << " bytes instead of "
+            << sizeof(float) * hostDataA.size() << " bytes" << std::endl;
+
+  std::cout << "Verify calculation result (host: " << expected << ", device: " << actual << ")... ";
+  if (std::abs(actual - expected) <= kRelativeEps * std::abs(expected)) {
+    std::cout << "OK" << std::endl;
+  } else {
+    std::cout << "NG" << std::endl;
+  }
+}
 
-  const auto builtBinaries = program.getInfo<CL_PROGRAM_BINARIES>();
-  for (const auto& binary : builtBinaries) {
-    std::ofstream ofs{baseName + "." + std::to_string(cnt) + ".bc", std::ios::binary};
-    if (!ofs.is_open()) {
-      std::cerr << "Failed to open: " << "kernel.bc" << std::endl;
-    }
-    ofs.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+
+/*!
+ * Elementwise product with innerProductHalf, which keeps a, b and c as fp16 in
+ * device memory and computes in fp32, halving the memory traffic.
+ * The operands are scaled into [0, 1] to fit in the range of half.
+ */
+inline void
+runHalfMultiply(
+  const cl::Context& context,
+  const cl::Device& device,
+  std::future<cl::Program>& programFuture,
+  std::size_t dataSize)
+{
+  // Each of the three roundings to half loses up to 2^-11 relative; the
+  // absolute term covers results in the subnormal range of half.
+  constexpr auto kRelativeEps = 2.0e-3f;
+  constexpr auto kAbsoluteEps = 1.0e-7f;
+
+  std::vector<float> hostDataA(dataSize);
+  std::vector<float> hostDataB(dataSize);
+  for (decltype(hostDataA)::size_type i = 0; i < hostDataA.size(); i++) {
+    hostDataA[i] = static_cast<float>(i) / static_cast<float>(dataSize);
+    hostDataB[i] = static_cast<float>(dataSize - i) / static_cast<float>(dataSize);
   }
 
-  return program;
+  clstudy::HostCompute hostCompute;
+  std::cout << "Multiply calculation on host (" << hostCompute.describe() << "): ";
+  std::vector<float> hostDataC1(dataSize);  // for answer (host)
+  const auto start1 = std::chrono::high_resolution_clock::now();
+  hostCompute.multiply(hostDataA.data(), hostDataB.data(), hostDataC1.data(), hostDataC1.size());
+  const auto elapsed1 = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start1).count();
+  std::cout << elapsed1 << " ms" << std::endl;
+
+  std::cout << "Convert host buffer A and B to half (F16C: " << (clstudy::isF16cAvailable() ? "yes" : "no") << "): ";
+  std::vector<cl_half> hostHalfA(dataSize);
+  std::vector<cl_half> hostHalfB(dataSize);
+  const auto start3 = std::chrono::high_resolution_clock::now();
+  clstudy::convertFloatToHalf(hostDataA.data(), hostHalfA.data(), dataSize);
+  clstudy::convertFloatToHalf(hostDataB.data(), hostHalfB.data(), dataSize);
+  const auto elapsed3 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start3).count();
+  std::cout << elapsed3 << " ms" << std::endl;
+
+  std::cout << "Wait for program build" << std::endl;
+  auto program = programFuture.get();
+  cl::Kernel kernel{program, "innerProductHalf"};
+
+  cl::Buffer deviceDataA{
+    context,
+    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    sizeof(cl_half) * hostHalfA.size(),
+    hostHalfA.data()};
+  cl::Buffer deviceDataB{
+    context,
+    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    sizeof(cl_half) * hostHalfB.size(),
+    hostHalfB.data()};
+  cl::Buffer deviceDataC{
+    context,
+    CL_MEM_WRITE_ONLY,
+    sizeof(cl_half) * dataSize};
+  kernel.setArg(0, deviceDataC);
+  kernel.setArg(1, deviceDataA);
+  kernel.setArg(2, deviceDataB);
+  kernel.setArg(3, static_cast<cl_uint>(dataSize));
+
+  cl::CommandQueue queue{context, device};
+  clstudy::WorkGroupTuner tuner;
+  const auto localRange = tuner.getLocalRange(queue, kernel, dataSize);
+
+  std::cout << "Multiply calculation on device: ";
+  const auto start2 = std::chrono::high_resolution_clock::now();
+  queue.enqueueNDRangeKernel(
+    kernel,
+    cl::NullRange,
+    cl::NDRange{dataSize},
+    localRange);
+  queue.finish();
+  const auto elapsed2 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start2).count();
+  std::cout << elapsed2 << " ms" << std::endl;
+
+  std::cout << "Copy device buffer C to host (" << sizeof(cl_half) * dataSize << " bytes) and convert to float" << std::endl;
+  std::vector<cl_half> hostHalfC2(dataSize);
+  queue.enqueueReadBuffer(
+    deviceDataC,
+    CL_TRUE,
+    0,
+    sizeof(cl_half) * hostHalfC2.size(),
+    hostHalfC2.data());
+  std::vector<float> hostDataC2(dataSize);  // for answer (device)
+  clstudy::convertHalfToFloat(hostHalfC2.data(), hostDataC2.data(), dataSize);
+
+  std::cout << "Verify calculation results... ";
+  clstudy::ResultVerifier verifier{hostCompute, clstudy::Tolerance::relative(kRelativeEps, kAbsoluteEps)};
+  const auto& report = verifier.verify(hostDataC1.data(), hostDataC2.data(), hostDataC2.size());
+  std::cout << (report.isOk() ? "OK" : "NG") << std::endl;
+  clstudy::printMismatches(std::cout, report);
 }
 
 }  // namespace
@@ -111,8 +342,8 @@ int
 main()
 {
   constexpr auto kDataSize = 1000000;
-  constexpr auto kEps = 1.0e-3f;
-  const std::string sourceFileName{"kernel.cl"};
+  // x * y is correctly rounded in OpenCL C; one ulp is left for relaxed math.
+  constexpr auto kMaxUlps = 1u;
 
   cl_int err = CL_SUCCESS;
   try {
@@ -130,19 +361,23 @@ main()
       0
     };
     std::cout << "Create context" << std::endl;
-    cl::Context context{CL_DEVICE_TYPE_GPU, properties};
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
 
     std::cout << "Get devices" << std::endl;
     std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
 
-    std::cout << "Build progam" << std::endl;
-    auto program = buildProgramFromFile(
+    const auto mode = getModeFromEnv();
+
+    std::cout << "Build progam in background" << std::endl;
+    clstudy::ThreadPool buildPool;
+    const auto start0 = std::chrono::high_resolution_clock::now();
+    // The sub-group built-ins of the inner product need OpenCL C 2.0.
+    auto programFuture = clstudy::buildProgramFromFileAsync(
+      buildPool,
       "kernel",
       context,
-      devices);
-
-    std::cout << "Create kernel" << std::endl;
-    cl::Kernel kernel{program, "innerProduct", &err};
+      devices,
+      mode == Mode::kDotProduct ? clstudy::getSubGroupBuildOptions(devices) : "");
 
 
     std::cout << "Allocate host buffer A" << std::endl;
@@ -155,17 +390,50 @@ main()
       hostDataA[i] = static_cast<float>(i);
       hostDataB[i] = static_cast<float>(hostDataA.size() - i);
     }
+
+    if (mode == Mode::kDotProduct) {
+      runDotProduct(context, devices[0], programFuture, hostDataA, hostDataB);
+      return 0;
+    } else if (mode == Mode::kHalfMultiply) {
+      runHalfMultiply(context, devices[0], programFuture, hostDataA.size());
+      return 0;
+    }
+
     std::cout << "Allocate host buffer C1 for host calculation" << std::endl;
     std::vector<float> hostDataC1(kDataSize);  // for answer (host)
 
-    std::cout << "Multiply calculation on host: ";
+    clstudy::HostCompute hostCompute;
+    std::cout << "Multiply calculation on host (" << hostCompute.describe() << "): ";
     const auto start1 = std::chrono::high_resolution_clock::now();
-    for (decltype(hostDataC1)::size_type i = 0; i < hostDataC1.size(); i++) {
-      hostDataC1[i] = hostDataA[i] * hostDataB[i];
-    }
-    const auto elapsed1 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start1).count();
+    hostCompute.multiply(hostDataA.data(), hostDataB.data(), hostDataC1.data(), hostDataC1.size());
+    const auto elapsed1 = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start1).count();
     std::cout << elapsed1 << " ms" << std::endl;
 
+    std::cout << "Wait for program build: ";
+    const auto start3 = std::chrono::high_resolution_clock::now();
+    auto program = programFuture.get();
+    const auto end3 = std::chrono::high_resolution_clock::now();
+    const auto elapsed3 = std::chrono::duration_cast<std::chrono::milliseconds>(end3 - start3).count();
+    const auto elapsed0 = std::chrono::duration_cast<std::chrono::milliseconds>(end3 - start0).count();
+    std::cout << elapsed3 << " ms (" << elapsed0 << " ms since build started)" << std::endl;
+
+    const auto isGridStride = isGridStrideLaunchFromEnv();
+    cl_uint vectorWidth = 1;
+    cl::Kernel kernel;
+    if (isGridStride) {
+      std::cout << "Create grid-stride kernel" << std::endl;
+      kernel = cl::Kernel{program, "innerProductGridStride"};
+      kernel.setArg(3, static_cast<cl_uint>(hostDataA.size()));
+    } else {
+      vectorWidth = clstudy::getPreferredFloatVectorWidth(devices[0]);
+      std::cout << "Create kernel for vector width " << vectorWidth << std::endl;
+      kernel = createInnerProductKernel(program, vectorWidth);
+      std::cout << "Use vector width " << vectorWidth << std::endl;
+      if (vectorWidth > 1) {
+        kernel.setArg(3, static_cast<cl_uint>(hostDataA.size()));
+      }
+    }
+
     std::cout << "Allocate device buffer" << std::endl;
     cl::Buffer deviceDataC{
       context,
@@ -193,44 +461,42 @@ main()
     cl::Event event;
     cl::CommandQueue queue{context, devices[0], 0, &err};
 
+    clstudy::WorkGroupTuner tuner;
+    std::size_t globalSize;
+    std::size_t localSize;
+    if (isGridStride) {
+      std::cout << "Get tuned grid-stride range: ";
+      const auto range = tuner.getGridStrideRange(queue, kernel, hostDataA.size());
+      globalSize = range.globalSize;
+      localSize = range.localSize;
+      std::cout << globalSize << " work-items in work-groups of " << localSize
+                << " (occupancy factor " << range.occupancyFactor << ")" << std::endl;
+    } else {
+      globalSize = (hostDataA.size() + vectorWidth - 1) / vectorWidth;
+      std::cout << "Get tuned local size: ";
+      localSize = tuner.getLocalSize(queue, kernel, globalSize);
+      std::cout << (localSize == 0 ? "default" : std::to_string(localSize)) << std::endl;
+    }
+
     std::cout << "Multiply calculation on device: ";
     const auto start2 = std::chrono::high_resolution_clock::now();
     queue.enqueueNDRangeKernel(
       kernel,
       cl::NullRange,
-      cl::NDRange(hostDataA.size(), 1, 1),
-      cl::NullRange,
+      cl::NDRange(globalSize, 1, 1),
+      localSize == 0 ? cl::NullRange : cl::NDRange(localSize, 1, 1),
       nullptr,
       &event);
     event.wait();
     const auto elapsed2 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start2).count();
     std::cout << elapsed2 << " ms" << std::endl;
 
-
-    std::cout << "Allocate host buffer C2 to retrieve device calculation result" << std::endl;
-    std::vector<float> hostDataC2(kDataSize);  // for answer (device)
-
-    std::cout << "Copy device buffer C to host buffer C2" << std::endl;
-    queue.enqueueReadBuffer(
-      deviceDataC,
-      CL_TRUE,
-      0,
-      sizeof(decltype(hostDataC2)::value_type) * hostDataC2.size(),
-      hostDataC2.data());
-
-    std::cout << "Verify calculation results... ";
-    const auto verifyResult = std::equal(
-      std::cbegin(hostDataC1),
-      std::cend(hostDataC1),
-      std::cbegin(hostDataC2),
-      [&kEps](const auto& x, const auto& y) {
-        return std::abs(x - y) < kEps;
-      });
-    if (verifyResult) {
-      std::cout << "OK" << std::endl;
-    } else {
-      std::cout << "NG" << std::endl;
-    }
+    // Only one chunk of the device result is mapped on the host at a time.
+    std::cout << "Verify calculation results while mapping device buffer C chunk by chunk... ";
+    clstudy::ResultVerifier verifier{hostCompute, clstudy::Tolerance::ulps(kMaxUlps)};
+    const auto& report = verifier.verifyBuffer(queue, deviceDataC, hostDataC1.data(), hostDataC1.size());
+    std::cout << (report.isOk() ? "OK" : "NG") << std::endl;
+    clstudy::printMismatches(std::cout, report);
   } catch (const cl::Error& ex) {
     std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
     return 1;
@@ -1,7 +1,6 @@
 #include <cmath>
 #include <cstring>
 #include <chrono>
-#include <fstream>
 #include <iostream>
 #include <iterator>
 #include <numeric>
@@ -9,110 +8,22 @@
 #include <string>
 
 #include <config/opencl.hpp>
-
-
-namespace
-{
-
-inline std::string
-removeSuffix(const std::string& filename) noexcept
-{
-  return filename.substr(0, filename.find_last_of("."));
-}
-
-
-inline std::size_t
-getStreamSize(std::istream& is) noexcept
-{
-  const auto currentPos = is.tellg();
-  is.seekg(0, std::ifstream::end);
-  const auto endPos = is.tellg();
-  is.seekg(currentPos, std::ifstream::beg);
-  return static_cast<std::size_t>(endPos - currentPos);
-}
-
-
-inline std::vector<unsigned char>
-readBinaryAll(std::ifstream& ifs) noexcept
-{
-  std::vector<unsigned char> binary(getStreamSize(ifs));
-  ifs.read(reinterpret_cast<char*>(&binary[0]), binary.size());
-  return binary;
-}
-
-
-inline std::string
-readTextAll(std::ifstream& ifs) noexcept
-{
-  std::string text;
-  text.resize(getStreamSize(ifs));
-  ifs.read(&text[0], text.size());
-  return text;
-}
-
-
-inline cl::Program
-buildProgramFromFile(
-  const std::string& baseName,
-  const cl::Context& context,
-  const std::vector<cl::Device>& devices,
-  bool saveBinary = true)
-{
-  int cnt = 0;
-  std::vector<std::vector<unsigned char>> loadedBinaries;
-  do {
-    std::ifstream ifs{baseName + "." + std::to_string(cnt) + ".bc", std::ios::binary};
-    if (!ifs.is_open()) {
-      cnt = 0;
-      continue;
-    }
-    loadedBinaries.emplace_back(readBinaryAll(ifs));
-  } while (cnt != 0);
-
-  if (loadedBinaries.size() > 0) {
-    cl::Program program(
-      context,
-      devices,
-      loadedBinaries);
-    program.build(devices);
-    return program;
-  }
-
-  const auto sourceFileName = std::string{baseName + ".cl"};
-  std::ifstream ifs{sourceFileName};
-  if (!ifs.is_open()) {
-    throw std::runtime_error{"Failed to open: " + sourceFileName};
-  }
-  cl::Program program = cl::Program(
-    context,
-    readTextAll(ifs));
-  program.build(devices);
-
-  if (!saveBinary) {
-    return program;
-  }
-
-  const auto builtBinaries = program.getInfo<CL_PROGRAM_BINARIES>();
-  for (const auto& binary : builtBinaries) {
-    std::ofstream ofs{baseName + "." + std::to_string(cnt) + ".bc", std::ios::binary};
-    if (!ofs.is_open()) {
-      std::cerr << "Failed to open: " << "kernel.bc" << std::endl;
-    }
-    ofs.write(reinterpret_cast<const char*>(binary.data()), binary.size());
-  }
-
-  return program;
-}
-
-}  // namespace
+#include <config/kernels.hpp>
+#include <clstudy/device_arena.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/host_compute.hpp>
+#include <clstudy/verify.hpp>
+#include <clstudy/program_cache.hpp>
+#include <clstudy/staging_pool.hpp>
 
 
 int
 main()
 {
   constexpr auto kDataSize = 1000000;
-  constexpr auto kEps = 1.0e-3f;
-  const std::string sourceFileName{"kernel.cl"};
+  constexpr auto kRequests = 4;
+  // x * y is correctly rounded in OpenCL C; one ulp is left for relaxed math.
+  constexpr auto kMaxUlps = 1u;
 
   cl_int err = CL_SUCCESS;
   try {
@@ -130,13 +41,13 @@ main()
       0
     };
     std::cout << "Create context" << std::endl;
-    cl::Context context{CL_DEVICE_TYPE_GPU, properties};
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
 
     std::cout << "Get devices" << std::endl;
     std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
 
     std::cout << "Build progam" << std::endl;
-    auto program = buildProgramFromFile(
+    auto program = clstudy::buildProgramFromFile(
       "kernel",
       context,
       devices);
@@ -150,102 +61,87 @@ main()
     cl::CommandQueue queue{context, devices[0], 0, &err};
 
 
-    std::cout << "Allocate host/device buffer A" << std::endl;
-    cl::Buffer deviceDataA{
-      context,
-      CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
-      sizeof(float) * kDataSize};
-    std::cout << "Retrieve pointer available on host from buffer A" << std::endl;
-    const auto ptrA = static_cast<float*>(queue.enqueueMapBuffer(
-      deviceDataA,
-      CL_TRUE,
-      CL_MAP_WRITE,
-      0,
-      sizeof(float) * kDataSize));
-
-    std::cout << "Allocate host/device buffer B" << std::endl;
-    cl::Buffer deviceDataB{
-      context,
-      CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
-      sizeof(float) * kDataSize};
-    std::cout << "Retrieve pointer available on host from buffer B" << std::endl;
-    const auto ptrB = static_cast<float*>(queue.enqueueMapBuffer(
-      deviceDataB,
-      CL_TRUE,
-      CL_MAP_WRITE,
-      0,
-      sizeof(float) * kDataSize));
-
-    std::cout << "Initialize buffer A and B" << std::endl;
-    for (int i = 0; i < kDataSize; i++) {
-      ptrA[i] = static_cast<float>(i);
-      ptrB[i] = static_cast<float>(kDataSize - i);
-    }
-
-    std::cout << "Release pointer from buffer A" << std::endl;
-    queue.enqueueUnmapMemObject(deviceDataA, ptrA);
-    std::cout << "Release pointer from buffer B" << std::endl;
-    queue.enqueueUnmapMemObject(deviceDataB, ptrB);
-
+    std::cout << "Allocate host/device buffer C" << std::endl;
+    cl::Buffer deviceDataC{context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, sizeof(float) * kDataSize};
+    kernel.setArg(0, deviceDataC);
 
     std::cout << "Allocate host buffer C1 for host calculation" << std::endl;
     std::vector<float> hostDataC1(kDataSize);  // for answer (host)
 
-    std::cout << "Multiply calculation on host: ";
-    const auto start1 = std::chrono::high_resolution_clock::now();
-    for (decltype(hostDataC1)::size_type i = 0; i < hostDataC1.size(); i++) {
-      hostDataC1[i] = ptrA[i] * ptrB[i];
+    clstudy::HostCompute hostCompute;
+    clstudy::ResultVerifier verifier{hostCompute, clstudy::Tolerance::ulps(kMaxUlps)};
+    // The pinned buffers of A and B are mapped once and recycled by every
+    // request, instead of being allocated and mapped each time.
+    clstudy::StagingBufferPool stagingPool{context, queue};
+    // The device buffers of A and B are sub-buffers of one block, which the
+    // requests share.
+    clstudy::DeviceArena deviceArena{context, devices[0]};
+    auto isAllOk = true;
+    for (auto request = 0; request < kRequests; request++) {
+      std::cout << "Request " << request + 1 << std::endl;
+
+      std::cout << "  Allocate device buffer A and B" << std::endl;
+      auto deviceDataA = deviceArena.allocate(sizeof(float) * kDataSize, CL_MEM_READ_ONLY);
+      auto deviceDataB = deviceArena.allocate(sizeof(float) * kDataSize, CL_MEM_READ_ONLY);
+      kernel.setArg(1, deviceDataA.buffer());
+      kernel.setArg(2, deviceDataB.buffer());
+
+      std::cout << "  Initialize staging buffer A and B" << std::endl;
+      auto stagingA = stagingPool.acquire(sizeof(float) * kDataSize);
+      auto stagingB = stagingPool.acquire(sizeof(float) * kDataSize);
+      const auto ptrA = stagingA.data<float>();
+      const auto ptrB = stagingB.data<float>();
+      for (int i = 0; i < kDataSize; i++) {
+        ptrA[i] = static_cast<float>(i + request);
+        ptrB[i] = static_cast<float>(kDataSize - i);
+      }
+
+      std::cout << "  Multiply calculation on host (" << hostCompute.describe() << "): ";
+      const auto start1 = std::chrono::high_resolution_clock::now();
+      hostCompute.multiply(ptrA, ptrB, hostDataC1.data(), hostDataC1.size());
+      const auto elapsed1 = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start1).count();
+      std::cout << elapsed1 << " ms" << std::endl;
+
+      std::cout << "  Multiply calculation on device, including transfers: ";
+      const auto start2 = std::chrono::high_resolution_clock::now();
+      const std::vector<cl::Event> transfers{
+        stagingA.copyTo(queue, deviceDataA),
+        stagingB.copyTo(queue, deviceDataB)};
+      // The staging buffers return to the pool, and are handed out again once
+      // the transfers have completed.
+      stagingA.release();
+      stagingB.release();
+      queue.enqueueNDRangeKernel(
+        kernel,
+        cl::NullRange,
+        cl::NDRange(kDataSize, 1, 1),
+        cl::NullRange,
+        &transfers,
+        &event);
+      // The ranges of A and B return to the arena, and are handed out again
+      // once the kernel has completed.
+      deviceDataA.release({event});
+      deviceDataB.release({event});
+      event.wait();
+      const auto elapsed2 = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start2).count();
+      std::cout << elapsed2 << " ms" << std::endl;
+
+      std::cout << "  Verify calculation results while mapping buffer C chunk by chunk... ";
+      const auto& report = verifier.verifyBuffer(queue, deviceDataC, hostDataC1.data(), hostDataC1.size());
+      std::cout << (report.isOk() ? "OK" : "NG") << std::endl;
+      clstudy::printMismatches(std::cout, report);
+      isAllOk &= report.isOk();
     }
-    const auto elapsed1 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start1).count();
-    std::cout << elapsed1 << " ms" << std::endl;
 
-    std::cout << "Allocate host/device buffer C" << std::endl;
-    cl::Buffer deviceDataC{
-      context,
-      CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
-      sizeof(decltype(hostDataC1)::value_type) * hostDataC1.size()};
-    kernel.setArg(0, deviceDataC);
-    kernel.setArg(1, deviceDataA);
-    kernel.setArg(2, deviceDataB);
-
-    std::cout << "Multiply calculation on device: ";
-    const auto start2 = std::chrono::high_resolution_clock::now();
-    queue.enqueueNDRangeKernel(
-      kernel,
-      cl::NullRange,
-      cl::NDRange(kDataSize, 1, 1),
-      cl::NullRange,
-      nullptr,
-      &event);
-    event.wait();
-    const auto elapsed2 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start2).count();
-    std::cout << elapsed2 << " ms" << std::endl;
-
-    std::cout << "Retrieve pointer available on host from buffer C" << std::endl;
-    const auto ptrC2 = static_cast<float*>(queue.enqueueMapBuffer(
-      deviceDataC,
-      CL_TRUE,
-      CL_MAP_READ,
-      0,
-      sizeof(float) * kDataSize));
-
-
-    std::cout << "Verify calculation results... ";
-    const auto verifyResult = std::equal(
-      std::cbegin(hostDataC1),
-      std::cend(hostDataC1),
-      ptrC2,
-      [&kEps](const auto& x, const auto& y) {
-        return std::abs(x - y) < kEps;
-      });
-    if (verifyResult) {
-      std::cout << "OK" << std::endl;
-    } else {
-      std::cout << "NG" << std::endl;
+    const auto stagingStats = stagingPool.stats();
+    std::cout << "Staging buffers: " << stagingStats.nAllocated << " allocated for "
+              << stagingStats.nAcquired << " leases, " << stagingStats.totalBytes << " bytes" << std::endl;
+    const auto arenaStats = deviceArena.stats();
+    std::cout << "Device arena: " << arenaStats.nBlocks << " blocks, " << arenaStats.reservedBytes << " bytes reserved, "
+              << arenaStats.highWaterBytes << " bytes at most in use, fragmentation " << arenaStats.fragmentation() << std::endl;
+    if (!isAllOk) {
+      return 1;
     }
-
-    std::cout << "Unsync device buffer C and host buffer C2" << std::endl;
-    queue.enqueueUnmapMemObject(deviceDataC, ptrC2);
   } catch (const cl::Error& ex) {
     std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
     return 1;
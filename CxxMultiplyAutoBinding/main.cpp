@@ -0,0 +1,122 @@
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/aligned_allocator.hpp>
+#include <clstudy/buffer_binding.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/host_compute.hpp>
+#include <clstudy/program_cache.hpp>
+#include <clstudy/verify.hpp>
+
+
+int
+main()
+{
+  constexpr std::size_t kAlignment = 4096;
+  constexpr std::size_t kDataSize = 1 << 20;
+  // x * y is correctly rounded in OpenCL C; one ulp is left for relaxed math.
+  constexpr auto kMaxUlps = 1u;
+
+  try {
+    std::cout << "Get platforms" << std::endl;
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0) {
+      std::cerr << "Platform not found" << std::endl;
+      return -1;
+    }
+
+    cl_context_properties properties[] = {
+      CL_CONTEXT_PLATFORM,
+      reinterpret_cast<cl_context_properties>((platforms[0])()),
+      0
+    };
+    std::cout << "Create context" << std::endl;
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
+
+    std::cout << "Get devices" << std::endl;
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+    std::cout << "Build progam" << std::endl;
+    auto program = clstudy::buildProgramFromFile("kernel", context, devices);
+
+    std::cout << "Create kernel" << std::endl;
+    cl::Kernel kernel{program, "innerProduct"};
+
+    clstudy::HostCompute hostCompute;
+    using HostVector = std::vector<float, clstudy::AlignedAllocator<float, kAlignment>>;
+    std::cout << "Allocate host buffer A and B" << std::endl;
+    HostVector hostDataA(kDataSize);
+    HostVector hostDataB(kDataSize);
+    for (decltype(hostDataA)::size_type i = 0; i < hostDataA.size(); i++) {
+      hostDataA[i] = static_cast<float>(i);
+      hostDataB[i] = static_cast<float>(hostDataA.size() - i);
+    }
+    std::cout << "Allocate host buffer C1" << std::endl;
+    HostVector hostDataC1(kDataSize);  // for answer (host)
+    std::cout << "Multiply calculation on host (" << hostCompute.describe() << "): ";
+    const auto start1 = std::chrono::high_resolution_clock::now();
+    hostCompute.multiply(hostDataA.data(), hostDataB.data(), hostDataC1.data(), hostDataC1.size());
+    const auto elapsed1 = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start1).count();
+    std::cout << elapsed1 << " ms" << std::endl;
+
+    std::cout << "Allocate host buffer C2" << std::endl;
+    HostVector hostDataC2(kDataSize);  // for answer (device)
+
+    clstudy::ResultVerifier verifier{hostCompute, clstudy::Tolerance::ulps(kMaxUlps)};
+    auto isAllOk = true;
+    for (const auto& device : devices) {
+      std::cout << "Device: " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
+      clstudy::BufferBinder binder{context, device};
+      const auto& decision = binder.choose(hostDataA.data());
+      std::cout << "  Binding strategy: " << clstudy::getBindingStrategyName(decision.strategy)
+                << " (" << decision.reason << ")" << std::endl;
+      // Offset by one float, the host pointer misses the base address
+      // alignment of the device.
+      const auto& unalignedDecision = binder.choose(hostDataA.data() + 1);
+      std::cout << "  Binding strategy for unaligned host buffers: " << clstudy::getBindingStrategyName(unalignedDecision.strategy)
+                << " (" << unalignedDecision.reason << ")" << std::endl;
+
+      std::fill(std::begin(hostDataC2), std::end(hostDataC2), 0.0f);
+      cl::CommandQueue queue{context, device};
+      std::cout << "  Multiply calculation on device, including transfers: ";
+      const auto start2 = std::chrono::high_resolution_clock::now();
+      const auto deviceDataA = binder.bind(hostDataA.data(), sizeof(float) * hostDataA.size(), CL_MEM_READ_ONLY);
+      const auto deviceDataB = binder.bind(hostDataB.data(), sizeof(float) * hostDataB.size(), CL_MEM_READ_ONLY);
+      const auto deviceDataC = binder.bind(hostDataC2.data(), sizeof(float) * hostDataC2.size(), CL_MEM_WRITE_ONLY);
+      kernel.setArg(0, deviceDataC.buffer());
+      kernel.setArg(1, deviceDataA.buffer());
+      kernel.setArg(2, deviceDataB.buffer());
+      queue.enqueueNDRangeKernel(
+        kernel,
+        cl::NullRange,
+        cl::NDRange(hostDataA.size(), 1, 1),
+        cl::NullRange);
+      deviceDataC.syncToHost(queue);
+      const auto elapsed2 = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start2).count();
+      std::cout << elapsed2 << " ms" << std::endl;
+
+      std::cout << "  Verify calculation results... ";
+      const auto& report = verifier.verify(hostDataC1.data(), hostDataC2.data(), hostDataC2.size());
+      std::cout << (report.isOk() ? "OK" : "NG") << std::endl;
+      clstudy::printMismatches(std::cout, report);
+      isAllOk &= report.isOk();
+    }
+
+    if (!isAllOk) {
+      return 1;
+    }
+  } catch (const cl::Error& ex) {
+    std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
+    return 1;
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+}
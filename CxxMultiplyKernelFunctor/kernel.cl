@@ -1,9 +1,45 @@
+// Specialized with build options, see clstudy::KernelVariant.
+#ifndef ELEM_TYPE
+#  define ELEM_TYPE float
+#endif  // ELEM_TYPE
+#ifndef VECTOR_WIDTH
+#  define VECTOR_WIDTH 1
+#endif  // VECTOR_WIDTH
+#ifndef UNROLL
+#  define UNROLL 1
+#endif  // UNROLL
+
+#ifdef ENABLE_FP64
+#  pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif  // ENABLE_FP64
+#ifdef ENABLE_FP16
+#  pragma OPENCL EXTENSION cl_khr_fp16 : enable
+#endif  // ENABLE_FP16
+
+#define CONCAT_(a, b) a ## b
+#define CONCAT(a, b) CONCAT_(a, b)
+
+#if VECTOR_WIDTH == 1
+typedef ELEM_TYPE vec_t;
+#else
+typedef CONCAT(ELEM_TYPE, VECTOR_WIDTH) vec_t;
+#endif  // VECTOR_WIDTH == 1
+
+
+// Each work-item handles UNROLL vectors, strided by the global size so that
+// neighbouring work-items still touch neighbouring addresses.
+// The number of elements must be a multiple of VECTOR_WIDTH * UNROLL.
 __kernel void
 innerProduct(
-    __global float *c,
-    __global const float *a,
-    __global const float *b)
+    __global vec_t *c,
+    __global const vec_t *a,
+    __global const vec_t *b)
 {
-  int i = get_global_id(0);
-  c[i] = a[i] * b[i];
+  const size_t i = get_global_id(0);
+  const size_t stride = get_global_size(0);
+#pragma unroll
+  for (int k = 0; k < UNROLL; k++) {
+    const size_t j = i + k * stride;
+    c[j] = a[j] * b[j];
+  }
 }
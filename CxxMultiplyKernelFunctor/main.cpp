@@ -2,133 +2,25 @@
 #include <cstring>
 #include <algorithm>
 #include <chrono>
-#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <stdexcept>
 #include <numeric>
 #include <vector>
 #include <string>
 #include <type_traits>
 
-#if __cplusplus >= 201703L || defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
-#  include <cstdlib>
-#elif defined(_MSC_VER) || defined(__MINGW32__)
-#  include <malloc.h>
-#else
-#  include <cstdlib>
-#endif  // defined(_MSC_VER) || defined(__MINGW32__)
-
 #include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/aligned_allocator.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/elementwise.hpp>
+#include <clstudy/kernel_variant.hpp>
 
 
 namespace
 {
 
-template<typename T = void>
-inline T*
-alignedMalloc(std::size_t nBytes, std::size_t alignment = alignof(T)) noexcept
-{
-#if __cplusplus >= 201703L || defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
-  return reinterpret_cast<T*>(std::aligned_alloc(alignment, nBytes));
-#elif defined(_MSC_VER) || defined(__MINGW32__)
-  return reinterpret_cast<T*>(::_aligned_malloc(nBytes, alignment));
-#else
-  void* p;
-  return reinterpret_cast<T*>(::posix_memalign(&p, alignment, nBytes) == 0 ? p : nullptr);
-#endif  // defined(_MSC_VER) || defined(__MINGW32__)
-}
-
-
-template<typename T>
-inline T*
-alignedAllocArray(std::size_t size, std::size_t alignment = alignof(T)) noexcept
-{
-  return alignedMalloc<T>(size * sizeof(T), alignment);
-}
-
-
-inline void
-alignedFree(void* ptr) noexcept
-{
-#if __cplusplus >= 201703L || defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
-  return std::free(ptr);
-#elif defined(_MSC_VER) || defined(__MINGW32__)
-  ::_aligned_free(ptr);
-#else
-  std::free(ptr);
-#endif  // defined(_MSC_VER) || defined(__MINGW32__)
-}
-
-
-template<
-  typename T,
-  std::size_t kAlignment = alignof(T)
->
-class AlignedAllocator
-{
-public:
-  using value_type = T;
-  using size_type = std::size_t;
-  using pointer = typename std::add_pointer<value_type>::type;
-  using const_pointer = typename std::add_pointer<const value_type>::type;
-
-  template<class U>
-  struct rebind
-  {
-    using other = AlignedAllocator<U, kAlignment>;
-  };
-
-  AlignedAllocator() noexcept
-  {}
-
-  template<typename U>
-  AlignedAllocator(const AlignedAllocator<U, kAlignment>&) noexcept
-  {}
-
-  pointer
-  allocate(size_type n, const_pointer /* hint */ = nullptr) const
-  {
-    auto p = alignedAllocArray<value_type>(n, kAlignment);
-    if (p == nullptr) {
-      throw std::bad_alloc{};
-    }
-    return p;
-  }
-
-  void
-  deallocate(pointer p, size_type /* n */) const noexcept
-  {
-    alignedFree(p);
-  }
-};  // class AlignedAllocator
-
-
-template<
-  typename T,
-  std::size_t kAlignment1,
-  typename U,
-  std::size_t kAlignment2
->
-inline bool
-operator==(const AlignedAllocator<T, kAlignment1>&, const AlignedAllocator<U, kAlignment2>&) noexcept
-{
-  return kAlignment1 == kAlignment2;
-}
-
-
-template<
-  typename T,
-  std::size_t kAlignment1,
-  typename U,
-  std::size_t kAlignment2
->
-inline bool
-operator!=(const AlignedAllocator<T, kAlignment1>& lhs, const AlignedAllocator<U, kAlignment2>& rhs) noexcept
-{
-  return !(lhs == rhs);
-}
-
-
 template<
   typename T,
   typename U
@@ -143,94 +35,173 @@ calcPotAlignedSize(T x, U n) noexcept
 }
 
 
-inline std::string
-removeSuffix(const std::string& filename) noexcept
-{
-  return filename.substr(0, filename.find_last_of("."));
-}
-
-
-inline std::size_t
-getStreamSize(std::istream& is) noexcept
-{
-  const auto currentPos = is.tellg();
-  is.seekg(0, std::ifstream::end);
-  const auto endPos = is.tellg();
-  is.seekg(currentPos, std::ifstream::beg);
-  return static_cast<std::size_t>(endPos - currentPos);
-}
-
-
-inline std::vector<unsigned char>
-readBinaryAll(std::ifstream& ifs) noexcept
+template<
+  typename TVariant,
+  std::size_t kAlignment
+>
+inline bool
+runInnerProduct(
+  clstudy::KernelVariantCache& variants,
+  const cl::Context& context,
+  const std::vector<cl::Device>& devices,
+  cl::CommandQueue& queue,
+  std::size_t dataSize)
 {
-  std::vector<unsigned char> binary(getStreamSize(ifs));
-  ifs.read(reinterpret_cast<char*>(&binary[0]), binary.size());
-  return binary;
-}
+  using T = typename TVariant::StorageType;
+  // Arithmetic type of the host, float for half
+  using H = typename TVariant::HostType;
+  using Traits = clstudy::KernelTypeTraits<typename TVariant::ElementType>;
+  using HostVector = std::vector<T, clstudy::AlignedAllocator<T, kAlignment>>;
+  // Relative; zero for integer types, i.e. exact comparison. Above one ulp of
+  // half.
+  constexpr auto kEps = H{1} / H{1000};
+
+  std::cout << "[" << TVariant::key() << "]" << std::endl;
+  if (!TVariant::isSupported(devices)) {
+    std::cout << "Not supported by the device, skipped" << std::endl;
+    return true;
+  }
+  if (dataSize % TVariant::kElementsPerWorkItem != 0) {
+    throw std::invalid_argument{"Data size must be a multiple of " + std::to_string(TVariant::kElementsPerWorkItem)};
+  }
 
+  std::cout << "Get kernel function (" << TVariant::buildOptions() << "): ";
+  const auto start0 = std::chrono::high_resolution_clock::now();
+  auto kernelFunc = variants.getKernelFunctor<
+    TVariant,
+    cl::Buffer&,
+    const cl::Buffer&,
+    const cl::Buffer&
+  >(context, devices, "innerProduct");
+  const auto elapsed0 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start0).count();
+  std::cout << elapsed0 << " ms" << std::endl;
+
+  // Keep the products below the largest half, 65504.
+  HostVector hostDataA(dataSize);
+  HostVector hostDataB(dataSize);
+  for (typename HostVector::size_type i = 0; i < hostDataA.size(); i++) {
+    hostDataA[i] = Traits::toStorage(static_cast<H>(i % 256));
+    hostDataB[i] = Traits::toStorage(static_cast<H>((hostDataA.size() - i) % 256));
+  }
 
-inline std::string
-readTextAll(std::ifstream& ifs) noexcept
-{
-  std::string text;
-  text.resize(getStreamSize(ifs));
-  ifs.read(&text[0], text.size());
-  return text;
+  std::cout << "Multiply calculation on host: ";
+  HostVector hostDataC1(dataSize);  // for answer (host)
+  const auto start1 = std::chrono::high_resolution_clock::now();
+  for (typename HostVector::size_type i = 0; i < hostDataC1.size(); i++) {
+    hostDataC1[i] = Traits::toStorage(static_cast<H>(Traits::toHost(hostDataA[i]) * Traits::toHost(hostDataB[i])));
+  }
+  const auto elapsed1 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start1).count();
+  std::cout << elapsed1 << " ms" << std::endl;
+
+  HostVector hostDataC2(dataSize);  // for answer (device)
+  cl::Buffer deviceDataC{context, std::begin(hostDataC2), std::end(hostDataC2), false, true};
+  cl::Buffer deviceDataA{context, std::begin(hostDataA), std::end(hostDataA), true, true};
+  cl::Buffer deviceDataB{context, std::begin(hostDataB), std::end(hostDataB), true, true};
+
+  std::cout << "Multiply calculation on device: ";
+  const auto start2 = std::chrono::high_resolution_clock::now();
+  auto event = kernelFunc(
+    cl::EnqueueArgs{
+      queue,
+      cl::NullRange,
+      cl::NDRange{dataSize / TVariant::kElementsPerWorkItem, 1, 1},
+      cl::NullRange},
+    deviceDataC,
+    deviceDataA,
+    deviceDataB);
+  event.wait();
+  const auto elapsed2 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start2).count();
+  std::cout << elapsed2 << " ms" << std::endl;
+
+  const auto ptrC2 = queue.enqueueMapBuffer(
+    deviceDataC,
+    CL_TRUE,
+    CL_MAP_READ,
+    0,
+    sizeof(T) * hostDataC2.size());
+
+  std::cout << "Verify calculation results... ";
+  const auto verifyResult = std::equal(
+    std::cbegin(hostDataC1),
+    std::cend(hostDataC1),
+    std::cbegin(hostDataC2),
+    [&kEps](const auto& x, const auto& y) {
+      const auto hostX = Traits::toHost(x);
+      return std::abs(hostX - Traits::toHost(y)) <= kEps * std::max(H{1}, std::abs(hostX));
+    });
+  std::cout << (verifyResult ? "OK" : "NG") << std::endl;
+
+  queue.enqueueUnmapMemObject(deviceDataC, ptrC2);
+  return verifyResult;
 }
 
 
-inline cl::Program
-buildProgramFromFile(
-  const std::string& baseName,
+/*!
+ * Compute c = a * b + alpha * d with one generated kernel.
+ */
+template<std::size_t kAlignment>
+inline bool
+runFusedElementwise(
   const cl::Context& context,
   const std::vector<cl::Device>& devices,
-  bool saveBinary = true)
+  cl::CommandQueue& queue,
+  std::size_t dataSize)
 {
-  int cnt = 0;
-  std::vector<std::vector<unsigned char>> loadedBinaries;
-  do {
-    std::ifstream ifs{baseName + "." + std::to_string(cnt) + ".bc", std::ios::binary};
-    if (!ifs.is_open()) {
-      cnt = 0;
-      continue;
-    }
-    loadedBinaries.emplace_back(readBinaryAll(ifs));
-  } while (cnt != 0);
-
-  if (loadedBinaries.size() > 0) {
-    cl::Program program(
-      context,
-      devices,
-      loadedBinaries);
-    program.build(devices);
-    return program;
-  }
-
-  const auto sourceFileName = std::string{baseName + ".cl"};
-  std::ifstream ifs{sourceFileName};
-  if (!ifs.is_open()) {
-    throw std::runtime_error{"Failed to open: " + sourceFileName};
+  using HostVector = std::vector<float, clstudy::AlignedAllocator<float, kAlignment>>;
+  constexpr auto kEps = 1.0e-3f;
+  constexpr auto kAlpha = 0.5f;
+
+  std::cout << "[fused c = a * b + alpha * d]" << std::endl;
+  HostVector hostDataA(dataSize);
+  HostVector hostDataB(dataSize);
+  HostVector hostDataD(dataSize);
+  for (typename HostVector::size_type i = 0; i < hostDataA.size(); i++) {
+    hostDataA[i] = static_cast<float>(i % 1024);
+    hostDataB[i] = static_cast<float>((hostDataA.size() - i) % 1024);
+    hostDataD[i] = static_cast<float>(i % 7);
   }
-  cl::Program program = cl::Program(
-    context,
-    readTextAll(ifs));
-  program.build(devices);
 
-  if (!saveBinary) {
-    return program;
+  HostVector hostDataC1(dataSize);  // for answer (host)
+  for (typename HostVector::size_type i = 0; i < hostDataC1.size(); i++) {
+    hostDataC1[i] = hostDataA[i] * hostDataB[i] + kAlpha * hostDataD[i];
   }
 
-  const auto builtBinaries = program.getInfo<CL_PROGRAM_BINARIES>();
-  for (const auto& binary : builtBinaries) {
-    std::ofstream ofs{baseName + "." + std::to_string(cnt) + ".bc", std::ios::binary};
-    if (!ofs.is_open()) {
-      std::cerr << "Failed to open: " << "kernel.bc" << std::endl;
-    }
-    ofs.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+  HostVector hostDataC2(dataSize);  // for answer (device)
+  clstudy::ElementwiseEngine engine{context, devices, queue};
+  auto c = engine.vector(cl::Buffer{context, std::begin(hostDataC2), std::end(hostDataC2), false, true});
+  const auto a = engine.vector(cl::Buffer{context, std::begin(hostDataA), std::end(hostDataA), true, true});
+  const auto b = engine.vector(cl::Buffer{context, std::begin(hostDataB), std::end(hostDataB), true, true});
+  const auto d = engine.vector(cl::Buffer{context, std::begin(hostDataD), std::end(hostDataD), true, true});
+
+  std::cout << clstudy::ElementwiseEngine::generateSource(a * b + kAlpha * d);
+  for (int i = 0; i < 2; i++) {
+    std::cout << "Fused calculation on device: ";
+    const auto start = std::chrono::high_resolution_clock::now();
+    c = a * b + kAlpha * d;
+    queue.finish();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << elapsed << " ms (" << engine.size() << " kernel memoized)" << std::endl;
   }
 
-  return program;
+  const auto ptrC2 = queue.enqueueMapBuffer(
+    c.buffer(),
+    CL_TRUE,
+    CL_MAP_READ,
+    0,
+    sizeof(float) * hostDataC2.size());
+
+  std::cout << "Verify calculation results... ";
+  const auto verifyResult = std::equal(
+    std::cbegin(hostDataC1),
+    std::cend(hostDataC1),
+    std::cbegin(hostDataC2),
+    [&kEps](const auto& x, const auto& y) {
+      return std::abs(x - y) <= kEps;
+    });
+  std::cout << (verifyResult ? "OK" : "NG") << std::endl;
+
+  queue.enqueueUnmapMemObject(c.buffer(), ptrC2);
+  return verifyResult;
 }
 
 }  // namespace
@@ -241,8 +212,6 @@ main()
 {
   constexpr auto kAlignment = calcPotAlignedSize(1, 12);
   constexpr auto kDataSize = calcPotAlignedSize(1000000, 6);
-  constexpr auto kEps = 1.0e-3f;
-  const std::string sourceFileName{"kernel.cl"};
 
   cl_int err = CL_SUCCESS;
   try {
@@ -260,98 +229,32 @@ main()
       0
     };
     std::cout << "Create context" << std::endl;
-    cl::Context context{CL_DEVICE_TYPE_GPU, properties};
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
 
     std::cout << "Get devices" << std::endl;
     std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
 
-    std::cout << "Build progam" << std::endl;
-    auto program = buildProgramFromFile(
-      "kernel",
-      context,
-      devices);
-
-    std::cout << "Create kernel function" << std::endl;
-    auto kernelFunc = cl::KernelFunctor<
-      cl::Buffer&,
-      const cl::Buffer&,
-      const cl::Buffer&
-    >{program, "innerProduct"};
-
-    std::cout << "Allocate host buffer A" << std::endl;
-    std::vector<float, AlignedAllocator<float, kAlignment>> hostDataA(kDataSize);
-    std::cout << "Allocate host buffer B" << std::endl;
-    std::vector<float, AlignedAllocator<float, kAlignment>> hostDataB(kDataSize);
-    for (decltype(hostDataA)::size_type i = 0; i < hostDataA.size(); i++) {
-      hostDataA[i] = static_cast<float>(i);
-      hostDataB[i] = static_cast<float>(hostDataA.size() - i);
-    }
-    std::cout << "Allocate host buffer C1" << std::endl;
-    std::vector<float, AlignedAllocator<float, kAlignment>> hostDataC1(kDataSize);  // for answer (host)
-
-    std::cout << "Multiply calculation on host: ";
-    const auto start1 = std::chrono::high_resolution_clock::now();
-    for (decltype(hostDataC1)::size_type i = 0; i < hostDataC1.size(); i++) {
-      hostDataC1[i] = hostDataA[i] * hostDataB[i];
-    }
-    const auto elapsed1 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start1).count();
-    std::cout << elapsed1 << " ms" << std::endl;
-
-    std::cout << "Allocate host buffer C2" << std::endl;
-    std::vector<float, AlignedAllocator<float, kAlignment>> hostDataC2(kDataSize);  // for answer (device)
-    std::cout << "Bind host buffer C2 to device buffer C" << std::endl;
-    cl::Buffer deviceDataC{context, std::begin(hostDataC2), std::end(hostDataC2), false, true};
-
-    std::cout << "Bind host buffer A to device buffer A" << std::endl;
-    cl::Buffer deviceDataA{context, std::begin(hostDataA), std::end(hostDataA), true, true};
-
-    std::cout << "Bind host buffer B to device buffer B" << std::endl;
-    cl::Buffer deviceDataB{context, std::begin(hostDataB), std::end(hostDataB), true, true};
-
     std::cout << "Create command queue" << std::endl;
     cl::CommandQueue queue{context, devices[0], 0, &err};
 
-    std::cout << "Multiply calculation on device: ";
-    const auto start2 = std::chrono::high_resolution_clock::now();
-    auto event = kernelFunc(
-      cl::EnqueueArgs{
-        queue,
-        cl::NullRange,
-        cl::NDRange{hostDataA.size(), 1, 1},
-        cl::NullRange},
-      deviceDataC,
-      deviceDataA,
-      deviceDataB);
-    event.wait();
-    const auto elapsed2 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start2).count();
-    std::cout << elapsed2 << " ms" << std::endl;
-
-    std::cout << "Synchronize device buffer C and host buffer C2" << std::endl;
-    const auto ptrC2 = queue.enqueueMapBuffer(
-      deviceDataC,
-      CL_TRUE,
-      CL_MAP_READ,
-      0,
-      sizeof(decltype(hostDataC2)::value_type) * hostDataC2.size());
-
-    std::cout << "ptrC2 " << ((ptrC2 == hostDataC2.data()) ? "==" : "!=") << " hostDataC2.data()" << std::endl;
-
-    std::cout << "Verify calculation results... ";
-    const auto verifyResult = std::equal(
-      std::cbegin(hostDataC1),
-      std::cend(hostDataC1),
-      std::cbegin(hostDataC2),
-      [&kEps](const auto& x, const auto& y) {
-        return std::abs(x - y) < kEps;
-      });
-    if (verifyResult) {
-      std::cout << "OK" << std::endl;
-    } else {
-      std::cout << "NG" << std::endl;
+    // Every variant is built from kernel.cl on first use.
+    clstudy::KernelVariantCache variants{"kernel"};
+    using clstudy::KernelVariant;
+    using clstudy::Unroll;
+    auto isAllOk = true;
+    isAllOk &= runInnerProduct<KernelVariant<float>, kAlignment>(variants, context, devices, queue, kDataSize);
+    isAllOk &= runInnerProduct<KernelVariant<float, 4, Unroll<8>>, kAlignment>(variants, context, devices, queue, kDataSize);
+    isAllOk &= runInnerProduct<KernelVariant<int, 4, Unroll<4>>, kAlignment>(variants, context, devices, queue, kDataSize);
+    isAllOk &= runInnerProduct<KernelVariant<double, 2, Unroll<4>>, kAlignment>(variants, context, devices, queue, kDataSize);
+    isAllOk &= runInnerProduct<KernelVariant<clstudy::Half, 4>, kAlignment>(variants, context, devices, queue, kDataSize);
+    // Already built, so this one is served from the memo.
+    isAllOk &= runInnerProduct<KernelVariant<float, 4, Unroll<8>>, kAlignment>(variants, context, devices, queue, kDataSize);
+    std::cout << variants.size() << " variants built" << std::endl;
+
+    isAllOk &= runFusedElementwise<kAlignment>(context, devices, queue, kDataSize);
+    if (!isAllOk) {
+      return 1;
     }
-
-    std::cout << "Unsync device buffer C and host buffer C2" << std::endl;
-    queue.enqueueUnmapMemObject(deviceDataC, ptrC2);
   } catch (const cl::Error& ex) {
     std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
     return 1;
@@ -0,0 +1,64 @@
+// Stages of the pipeline of CxxPipeline. STAGE_INPUT, STAGE_OUTPUT, STAGE_READ
+// and STAGE_WRITE are defined by clstudy::KernelPipeline, either for pipes or
+// for buffers.
+
+// The index travels with the value, since pipes do not keep the order of
+// packets.
+typedef struct
+{
+  uint index;
+  float value;
+} Packet;
+
+
+__kernel void
+produce(
+    STAGE_OUTPUT(Packet),
+    __global const float *input)
+{
+  Packet packet;
+  packet.index = get_global_id(0);
+  packet.value = input[packet.index];
+  STAGE_WRITE(&packet);
+}
+
+
+__kernel void
+scale(
+    STAGE_INPUT(Packet),
+    STAGE_OUTPUT(Packet),
+    float alpha)
+{
+  Packet packet;
+  if (STAGE_READ(&packet)) {
+    packet.value *= alpha;
+    STAGE_WRITE(&packet);
+  }
+}
+
+
+__kernel void
+clampValue(
+    STAGE_INPUT(Packet),
+    STAGE_OUTPUT(Packet),
+    float minValue,
+    float maxValue)
+{
+  Packet packet;
+  if (STAGE_READ(&packet)) {
+    packet.value = clamp(packet.value, minValue, maxValue);
+    STAGE_WRITE(&packet);
+  }
+}
+
+
+__kernel void
+consume(
+    STAGE_INPUT(Packet),
+    __global float *output)
+{
+  Packet packet;
+  if (STAGE_READ(&packet)) {
+    output[packet.index] = packet.value;
+  }
+}
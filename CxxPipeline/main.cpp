@@ -0,0 +1,151 @@
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/pipeline.hpp>
+
+
+namespace
+{
+
+// Arguments of the filters
+constexpr auto kAlpha = 2.0f;
+constexpr auto kMinValue = 0.25f;
+constexpr auto kMaxValue = 1.5f;
+
+
+// Packet of kernel.cl
+struct Packet
+{
+  cl_uint index;
+  cl_float value;
+};
+
+
+/*!
+ * Run input through produce, scale, clampValue and consume, print the
+ * throughput of each stage and verify the output against expected.
+ */
+inline bool
+runPipeline(
+  const cl::Context& context,
+  const cl::Device& device,
+  bool isPipeAllowed,
+  const std::vector<float>& hostInput,
+  const std::vector<float>& expected)
+{
+  constexpr std::size_t kBatchSize = 1 << 20;
+
+  cl::Buffer deviceInput{
+    context,
+    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+    sizeof(float) * hostInput.size(),
+    const_cast<float*>(hostInput.data())};
+  cl::Buffer deviceOutput{
+    context,
+    CL_MEM_WRITE_ONLY,
+    sizeof(float) * hostInput.size()};
+
+  clstudy::KernelPipeline pipeline{context, device, "kernel", sizeof(Packet), kBatchSize, "", isPipeAllowed};
+  pipeline
+    .addStage("produce", deviceInput)
+    .addStage("scale", kAlpha)
+    .addStage("clampValue", kMinValue, kMaxValue)
+    .addStage("consume", deviceOutput);
+
+  std::cout << "Stages connected by " << (pipeline.isPipeUsed() ? "pipes" : "buffers") << std::endl;
+  // Warm up
+  pipeline.run(hostInput.size());
+  const auto report = pipeline.run(hostInput.size());
+  std::cout << "  Total: " << report.seconds * 1.0e3 << " ms, "
+            << static_cast<double>(hostInput.size()) / report.seconds * 1.0e-6 << " Mpackets/s" << std::endl;
+  for (const auto& stage : report.stages) {
+    std::cout << "  " << stage.kernelName << ": " << stage.busySeconds * 1.0e3 << " ms busy, "
+              << stage.packetsPerSecond() * 1.0e-6 << " Mpackets/s" << std::endl;
+  }
+
+  cl::CommandQueue queue{context, device};
+  std::vector<float> actual(hostInput.size());
+  queue.enqueueReadBuffer(
+    deviceOutput,
+    CL_TRUE,
+    0,
+    sizeof(decltype(actual)::value_type) * actual.size(),
+    actual.data());
+
+  std::cout << "  Verify calculation results... ";
+  const auto verifyResult = std::equal(
+    std::cbegin(expected),
+    std::cend(expected),
+    std::cbegin(actual));
+  std::cout << (verifyResult ? "OK" : "NG") << std::endl;
+  return verifyResult;
+}
+
+}  // namespace
+
+
+int
+main()
+{
+  constexpr std::size_t kDataSize = 1 << 24;
+
+  try {
+    std::cout << "Get platforms" << std::endl;
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0) {
+      std::cerr << "Platform not found" << std::endl;
+      return -1;
+    }
+
+    cl_context_properties properties[] = {
+      CL_CONTEXT_PLATFORM,
+      reinterpret_cast<cl_context_properties>((platforms[0])()),
+      0
+    };
+    std::cout << "Create context" << std::endl;
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
+
+    std::cout << "Get devices" << std::endl;
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    const auto& device = devices[0];
+    std::cout << "Pipes: " << (clstudy::isPipeSupported(device) ? "supported" : "not supported") << std::endl;
+
+    std::cout << "Initialize host buffer" << std::endl;
+    std::mt19937 engine{0};
+    std::uniform_real_distribution<float> dist{0.0f, 1.0f};
+    std::vector<float> hostInput(kDataSize);
+    std::generate(std::begin(hostInput), std::end(hostInput), [&] {
+      return dist(engine);
+    });
+    // Scaling by a power of two is exact, so the results have to match exactly.
+    std::vector<float> expected(kDataSize);
+    std::transform(std::cbegin(hostInput), std::cend(hostInput), std::begin(expected), [](const auto& x) {
+      return std::min(std::max(x * kAlpha, kMinValue), kMaxValue);
+    });
+
+    auto isAllOk = true;
+    if (clstudy::isPipeSupported(device)) {
+      isAllOk &= runPipeline(context, device, true, hostInput, expected);
+    }
+    isAllOk &= runPipeline(context, device, false, hostInput, expected);
+
+    if (!isAllOk) {
+      return 1;
+    }
+  } catch (const cl::Error& ex) {
+    std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
+    return 1;
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,197 @@
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/primitives.hpp>
+
+
+namespace
+{
+
+/*!
+ * Average elapsed seconds of kRepeats calls of run after a warm-up. prepare is
+ * called before each of them, outside of the measured time.
+ */
+template<
+  typename F,
+  typename G
+>
+inline double
+measureSeconds(F prepare, G run)
+{
+  constexpr auto kRepeats = 5;
+
+  prepare();
+  run();
+  auto total = 0.0;
+  for (int i = 0; i < kRepeats; i++) {
+    prepare();
+    const auto start = std::chrono::high_resolution_clock::now();
+    run();
+    total += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  }
+  return total / kRepeats;
+}
+
+
+inline void
+printThroughput(const std::string& name, std::size_t n, double seconds)
+{
+  std::cout << name << ": " << seconds * 1.0e3 << " ms, "
+            << static_cast<double>(n) / seconds * 1.0e-6 << " Melem/s" << std::endl;
+}
+
+
+inline std::vector<cl_uint>
+readBuffer(cl::CommandQueue& queue, const cl::Buffer& buffer, std::size_t n)
+{
+  std::vector<cl_uint> data(n);
+  queue.enqueueReadBuffer(
+    buffer,
+    CL_TRUE,
+    0,
+    sizeof(decltype(data)::value_type) * data.size(),
+    data.data());
+  return data;
+}
+
+
+inline bool
+verify(const std::vector<cl_uint>& expected, const std::vector<cl_uint>& actual)
+{
+  std::cout << "  Verify calculation results... ";
+  const auto verifyResult = expected == actual;
+  std::cout << (verifyResult ? "OK" : "NG") << std::endl;
+  return verifyResult;
+}
+
+}  // namespace
+
+
+int
+main()
+{
+  constexpr std::size_t kDataSize = 1 << 24;
+
+  try {
+    std::cout << "Get platforms" << std::endl;
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0) {
+      std::cerr << "Platform not found" << std::endl;
+      return -1;
+    }
+
+    cl_context_properties properties[] = {
+      CL_CONTEXT_PLATFORM,
+      reinterpret_cast<cl_context_properties>((platforms[0])()),
+      0
+    };
+    std::cout << "Create context" << std::endl;
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
+
+    std::cout << "Get devices" << std::endl;
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+    std::cout << "Create command queue" << std::endl;
+    cl::CommandQueue queue{context, devices[0]};
+
+    std::cout << "Build primitives" << std::endl;
+    clstudy::ParallelPrimitives primitives{context, devices, queue};
+    std::cout << "Work-group scan: " << (primitives.isSubGroupUsed() ? "sub-groups" : "local memory") << std::endl;
+
+    std::cout << "Initialize " << kDataSize << " keys" << std::endl;
+    std::mt19937 engine{0};
+    std::vector<cl_uint> hostKeys(kDataSize);
+    std::generate(std::begin(hostKeys), std::end(hostKeys), [&] {
+      return static_cast<cl_uint>(engine());
+    });
+    std::vector<cl_uint> hostValues(kDataSize);
+    std::vector<cl_uint> hostFlags(kDataSize);
+    for (std::size_t i = 0; i < kDataSize; i++) {
+      hostValues[i] = hostKeys[i] & 0xff;
+      hostFlags[i] = hostKeys[i] & 1;
+    }
+
+    std::cout << "Allocate device buffers" << std::endl;
+    cl::Buffer deviceKeys{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(decltype(hostKeys)::value_type) * hostKeys.size(),
+      hostKeys.data()};
+    cl::Buffer deviceValues{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(decltype(hostValues)::value_type) * hostValues.size(),
+      hostValues.data()};
+    cl::Buffer deviceFlags{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(decltype(hostFlags)::value_type) * hostFlags.size(),
+      hostFlags.data()};
+    cl::Buffer deviceOutput{
+      context,
+      CL_MEM_READ_WRITE,
+      sizeof(cl_uint) * kDataSize};
+
+    auto isAllOk = true;
+
+    std::vector<cl_uint> expected(kDataSize);
+    printThroughput("std::inclusive_scan", kDataSize, measureSeconds([] {}, [&] {
+      std::inclusive_scan(std::cbegin(hostValues), std::cend(hostValues), std::begin(expected));
+    }));
+    printThroughput("inclusiveScan", kDataSize, measureSeconds([] {}, [&] {
+      primitives.inclusiveScan(deviceValues, deviceOutput, kDataSize);
+      queue.finish();
+    }));
+    isAllOk &= verify(expected, readBuffer(queue, deviceOutput, kDataSize));
+
+    expected.clear();
+    printThroughput("std::copy_if", kDataSize, measureSeconds([&] {
+      expected.clear();
+    }, [&] {
+      std::copy_if(std::cbegin(hostKeys), std::cend(hostKeys), std::back_inserter(expected), [](const auto& key) {
+        return (key & 1) != 0;
+      });
+    }));
+    std::size_t count = 0;
+    printThroughput("compact", kDataSize, measureSeconds([] {}, [&] {
+      count = primitives.compact(deviceKeys, deviceFlags, deviceOutput, kDataSize);
+    }));
+    std::cout << "  " << count << " of " << kDataSize << " elements kept" << std::endl;
+    isAllOk &= verify(expected, readBuffer(queue, deviceOutput, count));
+
+    printThroughput("std::sort", kDataSize, measureSeconds([&] {
+      expected = hostKeys;
+    }, [&] {
+      std::sort(std::begin(expected), std::end(expected));
+    }));
+    printThroughput("sortKeys", kDataSize, measureSeconds([&] {
+      queue.enqueueCopyBuffer(deviceKeys, deviceOutput, 0, 0, sizeof(cl_uint) * kDataSize);
+      queue.finish();
+    }, [&] {
+      primitives.sortKeys(deviceOutput, kDataSize);
+      queue.finish();
+    }));
+    isAllOk &= verify(expected, readBuffer(queue, deviceOutput, kDataSize));
+
+    if (!isAllOk) {
+      return 1;
+    }
+  } catch (const cl::Error& ex) {
+    std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
+    return 1;
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+}
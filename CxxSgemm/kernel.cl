@@ -0,0 +1,128 @@
+// C = A * B for row-major matrices A (M x K), B (K x N) and C (M x N).
+//
+// Build options:
+//   TILE_SIZE        Edge length of the square tiles staged in local memory.
+//   WORK_PER_THREAD  Number of elements of C per work-item in
+//                    sgemmRegisterBlocked; it must divide TILE_SIZE.
+#ifndef TILE_SIZE
+#  define TILE_SIZE 16
+#endif  // TILE_SIZE
+#ifndef WORK_PER_THREAD
+#  define WORK_PER_THREAD 4
+#endif  // WORK_PER_THREAD
+
+#define REDUCED_TILE_SIZE (TILE_SIZE / WORK_PER_THREAD)
+
+
+// One work-item per element of C, reading A and B straight from global memory.
+__kernel void
+sgemmNaive(
+    uint M,
+    uint N,
+    uint K,
+    __global const float *A,
+    __global const float *B,
+    __global float *C)
+{
+  const uint col = get_global_id(0);
+  const uint row = get_global_id(1);
+  if (row >= M || col >= N) {
+    return;
+  }
+
+  float acc = 0.0f;
+  for (uint k = 0; k < K; k++) {
+    acc += A[row * K + k] * B[k * N + col];
+  }
+  C[row * N + col] = acc;
+}
+
+
+// Local size must be TILE_SIZE x TILE_SIZE.
+// Each work-group walks along K one tile at a time, so every element of A and
+// B is read from global memory once per tile instead of once per product.
+__kernel void
+sgemmTiled(
+    uint M,
+    uint N,
+    uint K,
+    __global const float *A,
+    __global const float *B,
+    __global float *C)
+{
+  __local float tileA[TILE_SIZE][TILE_SIZE];
+  __local float tileB[TILE_SIZE][TILE_SIZE];
+
+  const uint lx = get_local_id(0);
+  const uint ly = get_local_id(1);
+  const uint col = get_group_id(0) * TILE_SIZE + lx;
+  const uint row = get_group_id(1) * TILE_SIZE + ly;
+
+  float acc = 0.0f;
+  for (uint t = 0; t < K; t += TILE_SIZE) {
+    tileA[ly][lx] = (row < M && t + lx < K) ? A[row * K + t + lx] : 0.0f;
+    tileB[ly][lx] = (t + ly < K && col < N) ? B[(t + ly) * N + col] : 0.0f;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint k = 0; k < TILE_SIZE; k++) {
+      acc += tileA[ly][k] * tileB[k][lx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (row < M && col < N) {
+    C[row * N + col] = acc;
+  }
+}
+
+
+// Local size must be TILE_SIZE x REDUCED_TILE_SIZE.
+// Same tiling as sgemmTiled, but each work-item computes WORK_PER_THREAD
+// elements of one column of C in registers, so a value of tileB loaded from
+// local memory is reused WORK_PER_THREAD times.
+__kernel void
+sgemmRegisterBlocked(
+    uint M,
+    uint N,
+    uint K,
+    __global const float *A,
+    __global const float *B,
+    __global float *C)
+{
+  __local float tileA[TILE_SIZE][TILE_SIZE];
+  __local float tileB[TILE_SIZE][TILE_SIZE];
+
+  const uint lx = get_local_id(0);
+  const uint ly = get_local_id(1);
+  const uint col = get_group_id(0) * TILE_SIZE + lx;
+  const uint rowBase = get_group_id(1) * TILE_SIZE;
+
+  float acc[WORK_PER_THREAD];
+  for (uint w = 0; w < WORK_PER_THREAD; w++) {
+    acc[w] = 0.0f;
+  }
+
+  for (uint t = 0; t < K; t += TILE_SIZE) {
+    for (uint w = 0; w < WORK_PER_THREAD; w++) {
+      const uint r = ly + w * REDUCED_TILE_SIZE;
+      tileA[r][lx] = (rowBase + r < M && t + lx < K) ? A[(rowBase + r) * K + t + lx] : 0.0f;
+      tileB[r][lx] = (t + r < K && col < N) ? B[(t + r) * N + col] : 0.0f;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (uint k = 0; k < TILE_SIZE; k++) {
+      const float b = tileB[k][lx];
+      for (uint w = 0; w < WORK_PER_THREAD; w++) {
+        acc[w] += tileA[ly + w * REDUCED_TILE_SIZE][k] * b;
+      }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  for (uint w = 0; w < WORK_PER_THREAD; w++) {
+    const uint row = rowBase + ly + w * REDUCED_TILE_SIZE;
+    if (row < M && col < N) {
+      C[row * N + col] = acc[w];
+    }
+  }
+}
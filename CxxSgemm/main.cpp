@@ -0,0 +1,295 @@
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <config/kernels.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/program_cache.hpp>
+
+
+namespace
+{
+
+inline std::size_t
+roundUp(std::size_t x, std::size_t n) noexcept
+{
+  return (x + n - 1) / n * n;
+}
+
+
+inline double
+calcGflops(std::size_t m, std::size_t n, std::size_t k, double seconds) noexcept
+{
+  return 2.0 * static_cast<double>(m) * static_cast<double>(n) * static_cast<double>(k) / seconds * 1.0e-9;
+}
+
+
+/*!
+ * Reference SGEMM on host, blocked so that the working set of the innermost
+ * loops stays in cache.
+ */
+inline void
+sgemmHost(
+  std::size_t m,
+  std::size_t n,
+  std::size_t k,
+  const std::vector<float>& a,
+  const std::vector<float>& b,
+  std::vector<float>& c)
+{
+  constexpr std::size_t kBlockSize = 64;
+
+  std::fill(std::begin(c), std::end(c), 0.0f);
+  for (std::size_t ii = 0; ii < m; ii += kBlockSize) {
+    const auto iEnd = std::min(ii + kBlockSize, m);
+    for (std::size_t kk = 0; kk < k; kk += kBlockSize) {
+      const auto kEnd = std::min(kk + kBlockSize, k);
+      for (std::size_t jj = 0; jj < n; jj += kBlockSize) {
+        const auto jEnd = std::min(jj + kBlockSize, n);
+        for (auto i = ii; i < iEnd; i++) {
+          for (auto p = kk; p < kEnd; p++) {
+            const auto aip = a[i * k + p];
+            for (auto j = jj; j < jEnd; j++) {
+              c[i * n + j] += aip * b[p * n + j];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+
+/*!
+ * Run kernel once to warm up and then kRepeats times, report the average
+ * GFLOP/s and verify the result against expected. deviceDataC is filled with
+ * NaN first, so that elements the kernel leaves unwritten fail verification
+ * instead of passing on the output of the previous kernel.
+ */
+inline bool
+runSgemmKernel(
+  cl::CommandQueue& queue,
+  cl::Kernel& kernel,
+  const cl::NDRange& globalRange,
+  const cl::NDRange& localRange,
+  std::size_t m,
+  std::size_t n,
+  std::size_t k,
+  const cl::Buffer& deviceDataC,
+  const std::vector<float>& expected)
+{
+  constexpr auto kRepeats = 5;
+  constexpr auto kEps = 1.0e-3f;
+
+  queue.enqueueFillBuffer(
+    deviceDataC,
+    std::numeric_limits<float>::quiet_NaN(),
+    0,
+    sizeof(float) * expected.size());
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange);
+  queue.finish();
+
+  const auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kRepeats; i++) {
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange);
+  }
+  queue.finish();
+  const auto elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / kRepeats;
+  std::cout << elapsed * 1.0e3 << " ms, " << calcGflops(m, n, k, elapsed) << " GFLOP/s" << std::endl;
+
+  std::vector<float> actual(expected.size());
+  queue.enqueueReadBuffer(
+    deviceDataC,
+    CL_TRUE,
+    0,
+    sizeof(decltype(actual)::value_type) * actual.size(),
+    actual.data());
+
+  std::cout << "  Verify calculation results... ";
+  const auto verifyResult = std::equal(
+    std::cbegin(expected),
+    std::cend(expected),
+    std::cbegin(actual),
+    [&kEps](const auto& x, const auto& y) {
+      return std::abs(x - y) <= kEps * std::max(1.0f, std::abs(x));
+    });
+  std::cout << (verifyResult ? "OK" : "NG") << std::endl;
+  return verifyResult;
+}
+
+
+inline void
+setSgemmArgs(
+  cl::Kernel& kernel,
+  cl_uint m,
+  cl_uint n,
+  cl_uint k,
+  const cl::Buffer& deviceDataA,
+  const cl::Buffer& deviceDataB,
+  const cl::Buffer& deviceDataC)
+{
+  kernel.setArg(0, m);
+  kernel.setArg(1, n);
+  kernel.setArg(2, k);
+  kernel.setArg(3, deviceDataA);
+  kernel.setArg(4, deviceDataB);
+  kernel.setArg(5, deviceDataC);
+}
+
+}  // namespace
+
+
+int
+main()
+{
+  constexpr cl_uint kM = 1024;
+  constexpr cl_uint kN = 1024;
+  constexpr cl_uint kK = 1024;
+  constexpr std::size_t kWorkPerThread = 4;
+  const std::size_t kTileSizes[] = {8, 16, 32};
+
+  try {
+    std::cout << "Get platforms" << std::endl;
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    if (platforms.size() == 0) {
+      std::cerr << "Platform not found" << std::endl;
+      return -1;
+    }
+
+    cl_context_properties properties[] = {
+      CL_CONTEXT_PLATFORM,
+      reinterpret_cast<cl_context_properties>((platforms[0])()),
+      0
+    };
+    std::cout << "Create context" << std::endl;
+    cl::Context context{clstudy::getDeviceTypeFromEnv(CL_DEVICE_TYPE_GPU), properties};
+
+    std::cout << "Get devices" << std::endl;
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    const auto& device = devices[0];
+    const auto maxWorkGroupSize = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+    std::cout << "Initialize host matrix A (" << kM << " x " << kK << ") and B (" << kK << " x " << kN << ")" << std::endl;
+    std::mt19937 engine{0};
+    std::uniform_real_distribution<float> dist{-1.0f, 1.0f};
+    std::vector<float> hostDataA(std::size_t{kM} * kK);
+    std::vector<float> hostDataB(std::size_t{kK} * kN);
+    std::generate(std::begin(hostDataA), std::end(hostDataA), [&] {
+      return dist(engine);
+    });
+    std::generate(std::begin(hostDataB), std::end(hostDataB), [&] {
+      return dist(engine);
+    });
+
+    std::cout << "SGEMM on host (blocked): ";
+    std::vector<float> hostDataC(std::size_t{kM} * kN);
+    const auto start1 = std::chrono::high_resolution_clock::now();
+    sgemmHost(kM, kN, kK, hostDataA, hostDataB, hostDataC);
+    const auto elapsed1 = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start1).count();
+    std::cout << elapsed1 * 1.0e3 << " ms, " << calcGflops(kM, kN, kK, elapsed1) << " GFLOP/s" << std::endl;
+
+    std::cout << "Allocate device buffers" << std::endl;
+    cl::Buffer deviceDataA{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(decltype(hostDataA)::value_type) * hostDataA.size(),
+      hostDataA.data()};
+    cl::Buffer deviceDataB{
+      context,
+      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(decltype(hostDataB)::value_type) * hostDataB.size(),
+      hostDataB.data()};
+    cl::Buffer deviceDataC{
+      context,
+      CL_MEM_WRITE_ONLY,
+      sizeof(decltype(hostDataC)::value_type) * hostDataC.size()};
+
+    std::cout << "Create command queue" << std::endl;
+    cl::CommandQueue queue{context, device};
+
+    auto isAllOk = true;
+    std::cout << "Build naive kernel" << std::endl;
+    {
+      auto program = clstudy::buildProgramFromFile("kernel", context, devices);
+      cl::Kernel kernel{program, "sgemmNaive"};
+      setSgemmArgs(kernel, kM, kN, kK, deviceDataA, deviceDataB, deviceDataC);
+      std::cout << "sgemmNaive: ";
+      isAllOk &= runSgemmKernel(
+        queue,
+        kernel,
+        cl::NDRange{kN, kM},
+        cl::NullRange,
+        kM,
+        kN,
+        kK,
+        deviceDataC,
+        hostDataC);
+    }
+
+    for (const auto tileSize : kTileSizes) {
+      if (tileSize * tileSize / kWorkPerThread > maxWorkGroupSize) {
+        break;
+      }
+      const auto options = "-D TILE_SIZE=" + std::to_string(tileSize)
+        + " -D WORK_PER_THREAD=" + std::to_string(kWorkPerThread);
+      std::cout << "Build tiled kernels (" << options << ")" << std::endl;
+      auto program = clstudy::buildProgramFromFile("kernel", context, devices, options);
+
+      cl::Kernel tiledKernel{program, "sgemmTiled"};
+      if (tileSize * tileSize <= tiledKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)) {
+        setSgemmArgs(tiledKernel, kM, kN, kK, deviceDataA, deviceDataB, deviceDataC);
+        std::cout << "sgemmTiled (" << tileSize << "): ";
+        isAllOk &= runSgemmKernel(
+          queue,
+          tiledKernel,
+          cl::NDRange{roundUp(kN, tileSize), roundUp(kM, tileSize)},
+          cl::NDRange{tileSize, tileSize},
+          kM,
+          kN,
+          kK,
+          deviceDataC,
+          hostDataC);
+      } else {
+        std::cout << "sgemmTiled (" << tileSize << "): work-group too large, skipped" << std::endl;
+      }
+
+      cl::Kernel blockedKernel{program, "sgemmRegisterBlocked"};
+      const auto reducedTileSize = tileSize / kWorkPerThread;
+      if (tileSize * reducedTileSize <= blockedKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device)) {
+        setSgemmArgs(blockedKernel, kM, kN, kK, deviceDataA, deviceDataB, deviceDataC);
+        std::cout << "sgemmRegisterBlocked (" << tileSize << ", " << kWorkPerThread << "): ";
+        isAllOk &= runSgemmKernel(
+          queue,
+          blockedKernel,
+          cl::NDRange{roundUp(kN, tileSize), roundUp(kM, tileSize) / kWorkPerThread},
+          cl::NDRange{tileSize, reducedTileSize},
+          kM,
+          kN,
+          kK,
+          deviceDataC,
+          hostDataC);
+      } else {
+        std::cout << "sgemmRegisterBlocked (" << tileSize << ", " << kWorkPerThread << "): work-group too large, skipped" << std::endl;
+      }
+    }
+
+    if (!isAllOk) {
+      return 1;
+    }
+  } catch (const cl::Error& ex) {
+    std::cerr << "ERROR: " << ex.what() << "(" << ex.err() << ")" << std::endl;
+    return 1;
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+}
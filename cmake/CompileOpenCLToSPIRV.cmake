@@ -0,0 +1,66 @@
+include(CMakeParseArguments)
+
+set(SPIRV_CURRENT_LIST_DIR "${CMAKE_CURRENT_LIST_DIR}")
+
+# Compile SOURCES to SPIR-V and link it into target, where loadKernelIL() of
+# clstudy/program_cache.hpp finds it by the file name without extension.
+function(compile_opencl_to_spirv target)
+  set(options)
+  set(oneValueArgs
+    OPENCL_C_VERSION)
+  set(multiValueArgs
+    SOURCES
+    OPTIONS)
+  cmake_parse_arguments(SPIRV "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+  if(NOT SPIRV_SOURCES)
+    message(FATAL_ERROR "compile_opencl_to_spirv requires at least one file in SOURCES")
+  endif()
+  if(NOT DEFINED SPIRV_OPENCL_C_VERSION)
+    set(SPIRV_OPENCL_C_VERSION "1.2")
+  endif()
+
+  find_program(OPENCL_CLANG_EXECUTABLE NAMES clang)
+  find_program(LLVM_SPIRV_EXECUTABLE NAMES llvm-spirv)
+  if(NOT OPENCL_CLANG_EXECUTABLE OR NOT LLVM_SPIRV_EXECUTABLE)
+    message(STATUS "clang or llvm-spirv not found; ${target} builds its kernels from OpenCL C at runtime")
+    return()
+  endif()
+
+  foreach(SOURCE_FILE ${SPIRV_SOURCES})
+    get_filename_component(SOURCE_PATH "${SOURCE_FILE}" ABSOLUTE)
+    get_filename_component(KERNEL_NAME "${SOURCE_FILE}" NAME_WE)
+    set(LLVM_BC_PATH "${CMAKE_CURRENT_BINARY_DIR}/${KERNEL_NAME}.spir64.bc")
+    set(SPIRV_PATH "${CMAKE_CURRENT_BINARY_DIR}/${KERNEL_NAME}.spv")
+    set(IL_SOURCE_PATH "${CMAKE_CURRENT_BINARY_DIR}/${KERNEL_NAME}.spv.cpp")
+
+    add_custom_command(
+      OUTPUT ${SPIRV_PATH}
+      COMMAND ${OPENCL_CLANG_EXECUTABLE}
+        -c -x cl -cl-std=CL${SPIRV_OPENCL_C_VERSION}
+        -target spir64-unknown-unknown -emit-llvm -O2
+        -Xclang -finclude-default-header
+        ${SPIRV_OPTIONS}
+        -o ${LLVM_BC_PATH}
+        ${SOURCE_PATH}
+      COMMAND ${LLVM_SPIRV_EXECUTABLE} ${LLVM_BC_PATH} -o ${SPIRV_PATH}
+      DEPENDS ${SOURCE_PATH}
+      COMMENT "Compiling ${SOURCE_FILE} to SPIR-V"
+      VERBATIM)
+    add_custom_command(
+      OUTPUT ${IL_SOURCE_PATH}
+      COMMAND ${CMAKE_COMMAND}
+        -D KERNEL_NAME=${KERNEL_NAME}
+        -D IL_PATH=${SPIRV_PATH}
+        -D TEMPLATE_PATH=${SPIRV_CURRENT_LIST_DIR}/templates/embeddedKernelIL.cpp.in
+        -D OUTPUT_PATH=${IL_SOURCE_PATH}
+        -P ${SPIRV_CURRENT_LIST_DIR}/EmbedKernelIL.cmake
+      DEPENDS
+        ${SPIRV_PATH}
+        ${SPIRV_CURRENT_LIST_DIR}/EmbedKernelIL.cmake
+        ${SPIRV_CURRENT_LIST_DIR}/templates/embeddedKernelIL.cpp.in
+      COMMENT "Embedding ${KERNEL_NAME}.spv"
+      VERBATIM)
+    target_sources(${target} PRIVATE ${IL_SOURCE_PATH})
+  endforeach()
+endfunction()
@@ -0,0 +1,25 @@
+# Run by compile_opencl_to_spirv() at build time as
+#   cmake -D KERNEL_NAME=... -D IL_PATH=... -D TEMPLATE_PATH=... -D OUTPUT_PATH=... -P EmbedKernelIL.cmake
+# to write a source file which registers the SPIR-V at IL_PATH as KERNEL_NAME.
+
+foreach(REQUIRED_VARIABLE KERNEL_NAME IL_PATH TEMPLATE_PATH OUTPUT_PATH)
+  if(NOT DEFINED ${REQUIRED_VARIABLE})
+    message(FATAL_ERROR "EmbedKernelIL.cmake requires ${REQUIRED_VARIABLE}")
+  endif()
+endforeach()
+
+# Same layout as the sources of generate_embedded_kernel_header().
+file(READ "${IL_PATH}" IL_HEX HEX)
+string(LENGTH "${IL_HEX}" IL_HEX_LENGTH)
+set(EMBEDDED_KERNEL_IL_CHARS "")
+set(IL_HEX_OFFSET 0)
+while(IL_HEX_OFFSET LESS IL_HEX_LENGTH)
+  string(SUBSTRING "${IL_HEX}" ${IL_HEX_OFFSET} 32 IL_HEX_LINE)
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "'\\\\x\\1'," IL_HEX_LINE "${IL_HEX_LINE}")
+  set(EMBEDDED_KERNEL_IL_CHARS "${EMBEDDED_KERNEL_IL_CHARS}  ${IL_HEX_LINE}\n")
+  math(EXPR IL_HEX_OFFSET "${IL_HEX_OFFSET} + 32")
+endwhile()
+
+set(EMBEDDED_KERNEL_IL_PATH "${IL_PATH}")
+set(EMBEDDED_KERNEL_NAME "${KERNEL_NAME}")
+configure_file("${TEMPLATE_PATH}" "${OUTPUT_PATH}" @ONLY)
@@ -0,0 +1,63 @@
+include(CMakeParseArguments)
+
+set(EMBEDDED_KERNEL_CURRENT_LIST_DIR "${CMAKE_CURRENT_LIST_DIR}")
+
+function(generate_embedded_kernel_header header_file_path)
+  set(options)
+  set(oneValueArgs)
+  set(multiValueArgs
+    SOURCES)
+  cmake_parse_arguments(EMBEDDED_KERNEL "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+  if(NOT EMBEDDED_KERNEL_SOURCES)
+    message(FATAL_ERROR "generate_embedded_kernel_header requires at least one file in SOURCES")
+  endif()
+
+  get_filename_component(EMBEDDED_KERNEL_INCLUDE_GUARD_MACRO "${header_file_path}" NAME)
+  string(REGEX REPLACE "[^0-9A-Za-z_]" "_" EMBEDDED_KERNEL_INCLUDE_GUARD_MACRO "${EMBEDDED_KERNEL_INCLUDE_GUARD_MACRO}")
+  string(TOUPPER ${EMBEDDED_KERNEL_INCLUDE_GUARD_MACRO} EMBEDDED_KERNEL_INCLUDE_GUARD_MACRO)
+
+  set(EMBEDDED_KERNEL_DEFINITIONS "")
+  set(EMBEDDED_KERNEL_INDEX 0)
+  foreach(SOURCE_FILE ${EMBEDDED_KERNEL_SOURCES})
+    get_filename_component(SOURCE_PATH "${SOURCE_FILE}" ABSOLUTE)
+    get_filename_component(KERNEL_NAME "${SOURCE_FILE}" NAME_WE)
+
+    # Emit the source as a list of character literals rather than a string
+    # literal, which avoids escaping and the string length limit of MSVC.
+    file(READ "${SOURCE_PATH}" SOURCE_HEX HEX)
+    string(LENGTH "${SOURCE_HEX}" SOURCE_HEX_LENGTH)
+    set(SOURCE_CHARS "")
+    set(SOURCE_HEX_OFFSET 0)
+    while(SOURCE_HEX_OFFSET LESS SOURCE_HEX_LENGTH)
+      string(SUBSTRING "${SOURCE_HEX}" ${SOURCE_HEX_OFFSET} 32 SOURCE_HEX_LINE)
+      string(REGEX REPLACE "([0-9a-f][0-9a-f])" "'\\\\x\\1'," SOURCE_HEX_LINE "${SOURCE_HEX_LINE}")
+      set(SOURCE_CHARS "${SOURCE_CHARS}  ${SOURCE_HEX_LINE}\n")
+      math(EXPR SOURCE_HEX_OFFSET "${SOURCE_HEX_OFFSET} + 32")
+    endwhile()
+
+    set(ARRAY_NAME "kEmbeddedKernelSource${EMBEDDED_KERNEL_INDEX}")
+    string(CONCAT EMBEDDED_KERNEL_DEFINITIONS
+      "${EMBEDDED_KERNEL_DEFINITIONS}"
+      "// ${SOURCE_PATH}\n"
+      "constexpr char ${ARRAY_NAME}[] = {\n"
+      "${SOURCE_CHARS}"
+      "  '\\0'\n"
+      "};\n"
+      "const clstudy::KernelSourceRegistrar kEmbeddedKernelRegistrar${EMBEDDED_KERNEL_INDEX}{\n"
+      "  \"${KERNEL_NAME}\",\n"
+      "  ${ARRAY_NAME},\n"
+      "  sizeof(${ARRAY_NAME}) - 1};\n"
+      "\n")
+
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${SOURCE_PATH}")
+    math(EXPR EMBEDDED_KERNEL_INDEX "${EMBEDDED_KERNEL_INDEX} + 1")
+  endforeach()
+
+  configure_file(
+    ${EMBEDDED_KERNEL_CURRENT_LIST_DIR}/templates/embeddedKernels.hpp.in
+    ${header_file_path}
+    @ONLY)
+
+  message(STATUS "Configure done. Output file: ${header_file_path}")
+endfunction()
@@ -0,0 +1,176 @@
+#ifndef CLSTUDY_ALIGNED_ALLOCATOR_HPP
+#define CLSTUDY_ALIGNED_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 201703L || defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
+#  include <cstdlib>
+#elif defined(_MSC_VER) || defined(__MINGW32__)
+#  include <malloc.h>
+#else
+#  include <cstdlib>
+#endif  // defined(_MSC_VER) || defined(__MINGW32__)
+
+
+namespace clstudy
+{
+
+template<typename T = void>
+inline T*
+alignedMalloc(std::size_t nBytes, std::size_t alignment = alignof(T)) noexcept
+{
+#if __cplusplus >= 201703L || defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
+  return reinterpret_cast<T*>(std::aligned_alloc(alignment, nBytes));
+#elif defined(_MSC_VER) || defined(__MINGW32__)
+  return reinterpret_cast<T*>(::_aligned_malloc(nBytes, alignment));
+#else
+  void* p;
+  return reinterpret_cast<T*>(::posix_memalign(&p, alignment, nBytes) == 0 ? p : nullptr);
+#endif  // defined(_MSC_VER) || defined(__MINGW32__)
+}
+
+
+template<typename T>
+inline T*
+alignedAllocArray(std::size_t size, std::size_t alignment = alignof(T)) noexcept
+{
+  return alignedMalloc<T>(size * sizeof(T), alignment);
+}
+
+
+inline void
+alignedFree(void* ptr) noexcept
+{
+#if __cplusplus >= 201703L || defined(_MSVC_LANG) && _MSVC_LANG >= 201703L
+  return std::free(ptr);
+#elif defined(_MSC_VER) || defined(__MINGW32__)
+  ::_aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif  // defined(_MSC_VER) || defined(__MINGW32__)
+}
+
+
+template<
+  typename T,
+  std::size_t kAlignment = alignof(T)
+>
+class AlignedAllocator
+{
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using pointer = typename std::add_pointer<value_type>::type;
+  using const_pointer = typename std::add_pointer<const value_type>::type;
+
+  template<class U>
+  struct rebind
+  {
+    using other = AlignedAllocator<U, kAlignment>;
+  };
+
+  AlignedAllocator() noexcept
+  {}
+
+  template<typename U>
+  AlignedAllocator(const AlignedAllocator<U, kAlignment>&) noexcept
+  {}
+
+  pointer
+  allocate(size_type n, const_pointer /* hint */ = nullptr) const
+  {
+    auto p = alignedAllocArray<value_type>(n, kAlignment);
+    if (p == nullptr) {
+      throw std::bad_alloc{};
+    }
+    return p;
+  }
+
+  void
+  deallocate(pointer p, size_type /* n */) const noexcept
+  {
+    alignedFree(p);
+  }
+};  // class AlignedAllocator
+
+
+template<
+  typename T,
+  std::size_t kAlignment1,
+  typename U,
+  std::size_t kAlignment2
+>
+inline bool
+operator==(const AlignedAllocator<T, kAlignment1>&, const AlignedAllocator<U, kAlignment2>&) noexcept
+{
+  return kAlignment1 == kAlignment2;
+}
+
+
+template<
+  typename T,
+  std::size_t kAlignment1,
+  typename U,
+  std::size_t kAlignment2
+>
+inline bool
+operator!=(const AlignedAllocator<T, kAlignment1>& lhs, const AlignedAllocator<U, kAlignment2>& rhs) noexcept
+{
+  return !(lhs == rhs);
+}
+
+
+/*!
+ * AlignedAllocator whose construct() default-initializes instead of
+ * value-initializing, so that std::vector<float, UninitializedAllocator<...>>
+ * of n elements leaves them indeterminate and its pages untouched. The pages
+ * are then first touched, and placed on a NUMA node, by whoever initializes
+ * the elements, e.g. HostCompute::generate().
+ */
+template<
+  typename T,
+  std::size_t kAlignment = alignof(T)
+>
+class UninitializedAllocator : public AlignedAllocator<T, kAlignment>
+{
+public:
+  template<class U>
+  struct rebind
+  {
+    using other = UninitializedAllocator<U, kAlignment>;
+  };
+
+  UninitializedAllocator() noexcept
+    : AlignedAllocator<T, kAlignment>()
+  {}
+
+  template<typename U>
+  UninitializedAllocator(const UninitializedAllocator<U, kAlignment>&) noexcept
+    : AlignedAllocator<T, kAlignment>()
+  {}
+
+  template<typename U>
+  void
+  construct(U* p) const noexcept(std::is_nothrow_default_constructible<U>::value)
+  {
+    ::new(static_cast<void*>(p)) U;
+  }
+
+  template<
+    typename U,
+    typename... Args
+  >
+  void
+  construct(U* p, Args&&... args) const
+  {
+    ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+};  // class UninitializedAllocator
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_ALIGNED_ALLOCATOR_HPP
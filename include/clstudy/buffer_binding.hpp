@@ -0,0 +1,378 @@
+#ifndef CLSTUDY_BUFFER_BINDING_HPP
+#define CLSTUDY_BUFFER_BINDING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/aligned_allocator.hpp>
+
+
+namespace clstudy
+{
+
+/*!
+ * Ways to give a device access to data in host memory:
+ *
+ * - kCopyHostPtr: a buffer in device memory, written from and read back to the
+ *   host memory with copies.
+ * - kUseHostPtr: the host memory itself, which devices sharing memory with the
+ *   host access without a copy.
+ * - kAllocHostPtr: host-visible memory allocated by the driver, usually
+ *   pinned, copied from and to the host memory through mappings.
+ */
+enum class BindingStrategy
+{
+  kCopyHostPtr,
+  kUseHostPtr,
+  kAllocHostPtr
+};
+
+
+inline const char*
+getBindingStrategyName(BindingStrategy strategy) noexcept
+{
+  switch (strategy) {
+    case BindingStrategy::kCopyHostPtr:
+      return "copy-host-ptr";
+    case BindingStrategy::kUseHostPtr:
+      return "use-host-ptr";
+    case BindingStrategy::kAllocHostPtr:
+      return "alloc-host-ptr";
+    default:
+      return "unknown";
+  }
+}
+
+
+/*!
+ * Whether the environment variable CLSTUDY_BINDING names a strategy, one of
+ * "copy-host-ptr", "use-host-ptr" and "alloc-host-ptr", to use instead of the
+ * chosen one.
+ */
+inline bool
+getBindingStrategyFromEnv(BindingStrategy& strategy)
+{
+  const auto value = std::getenv("CLSTUDY_BINDING");
+  if (value == nullptr || value[0] == '\0') {
+    return false;
+  }
+
+  const std::string name{value};
+  for (const auto candidate : {BindingStrategy::kCopyHostPtr, BindingStrategy::kUseHostPtr, BindingStrategy::kAllocHostPtr}) {
+    if (name == getBindingStrategyName(candidate)) {
+      strategy = candidate;
+      return true;
+    }
+  }
+  throw std::runtime_error{"Unknown CLSTUDY_BINDING: " + name};
+}
+
+
+struct BindingDecision
+{
+  BindingStrategy strategy;
+  // Why strategy was chosen, for logs
+  std::string reason;
+};
+
+
+/*!
+ * Host memory bound to a device buffer with a BindingStrategy.
+ *
+ * Buffers the device reads, i.e. not CL_MEM_WRITE_ONLY ones, start with the
+ * contents of the host memory. Afterwards, syncToDevice() makes host writes
+ * visible to the device, and syncToHost() device writes to the host; both
+ * block until the host memory may be used.
+ */
+class BoundBuffer
+{
+public:
+  BoundBuffer(
+    const cl::Context& context,
+    BindingStrategy strategy,
+    cl_mem_flags access,
+    void* hostPtr,
+    std::size_t size)
+    : m_buffer(createBuffer(context, strategy, access, hostPtr, size))
+    , m_strategy(strategy)
+    , m_hostPtr(hostPtr)
+    , m_size(size)
+  {}
+
+  const cl::Buffer&
+  buffer() const noexcept
+  {
+    return m_buffer;
+  }
+
+  operator const cl::Buffer&() const noexcept
+  {
+    return m_buffer;
+  }
+
+  BindingStrategy
+  strategy() const noexcept
+  {
+    return m_strategy;
+  }
+
+  void*
+  hostPtr() const noexcept
+  {
+    return m_hostPtr;
+  }
+
+  std::size_t
+  size() const noexcept
+  {
+    return m_size;
+  }
+
+  void
+  syncToDevice(const cl::CommandQueue& queue) const
+  {
+    if (m_strategy == BindingStrategy::kCopyHostPtr) {
+      queue.enqueueWriteBuffer(m_buffer, CL_TRUE, 0, m_size, m_hostPtr);
+      return;
+    }
+    // Unmapping a CL_MEM_USE_HOST_PTR buffer mapped for writing publishes the
+    // host memory to the device. The whole buffer is overwritten, so the
+    // mapping must not copy the device contents over the host memory first.
+    const auto ptr = queue.enqueueMapBuffer(m_buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, m_size);
+    if (ptr != m_hostPtr) {
+      std::memcpy(ptr, m_hostPtr, m_size);
+    }
+    cl::Event event;
+    queue.enqueueUnmapMemObject(m_buffer, ptr, nullptr, &event);
+    event.wait();
+  }
+
+  void
+  syncToHost(const cl::CommandQueue& queue) const
+  {
+    if (m_strategy == BindingStrategy::kCopyHostPtr) {
+      queue.enqueueReadBuffer(m_buffer, CL_TRUE, 0, m_size, m_hostPtr);
+      return;
+    }
+    // Mapping a CL_MEM_USE_HOST_PTR buffer returns the host memory itself.
+    const auto ptr = queue.enqueueMapBuffer(m_buffer, CL_TRUE, CL_MAP_READ, 0, m_size);
+    if (ptr != m_hostPtr) {
+      std::memcpy(m_hostPtr, ptr, m_size);
+    }
+    queue.enqueueUnmapMemObject(m_buffer, ptr);
+  }
+
+private:
+  static cl::Buffer
+  createBuffer(
+    const cl::Context& context,
+    BindingStrategy strategy,
+    cl_mem_flags access,
+    void* hostPtr,
+    std::size_t size)
+  {
+    const auto isRead = (access & CL_MEM_WRITE_ONLY) == 0;
+    switch (strategy) {
+      case BindingStrategy::kUseHostPtr:
+        return cl::Buffer{context, access | CL_MEM_USE_HOST_PTR, size, hostPtr};
+      case BindingStrategy::kAllocHostPtr:
+        return isRead
+          ? cl::Buffer{context, access | CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR, size, hostPtr}
+          : cl::Buffer{context, access | CL_MEM_ALLOC_HOST_PTR, size};
+      case BindingStrategy::kCopyHostPtr:
+      default:
+        return isRead
+          ? cl::Buffer{context, access | CL_MEM_COPY_HOST_PTR, size, hostPtr}
+          : cl::Buffer{context, access, size};
+    }
+  }
+
+  cl::Buffer m_buffer;
+  BindingStrategy m_strategy;
+  void* m_hostPtr;
+  std::size_t m_size;
+};
+
+
+/*!
+ * Binds host memory to buffers of one device with the cheapest strategy for
+ * it, so that code need not be written for one of the three.
+ *
+ * - Devices sharing memory with the host, i.e. CPUs and devices reporting
+ *   CL_DEVICE_HOST_UNIFIED_MEMORY, use host memory aligned to
+ *   CL_DEVICE_MEM_BASE_ADDR_ALIGN in place. Unaligned memory would be copied
+ *   by the driver anyway, and is bound with kAllocHostPtr.
+ * - Other devices are calibrated on first use: a round trip of
+ *   kCalibrationSize bytes to the device and back is timed with each
+ *   strategy, and the fastest is taken. kUseHostPtr takes part only for
+ *   aligned memory.
+ *
+ * Decisions are cached for aligned and unaligned memory, and tell their
+ * reason. CLSTUDY_BINDING overrides them. Thread-safe.
+ */
+class BufferBinder
+{
+public:
+  static constexpr std::size_t kCalibrationSize = 4 * 1024 * 1024;
+  static constexpr int kCalibrationRepeats = 3;
+
+  BufferBinder(cl::Context context, cl::Device device)
+    : m_context(std::move(context))
+    , m_device(std::move(device))
+    , m_alignment(std::max<std::size_t>(1, m_device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8))
+    , m_decisions()
+    , m_calibration()
+    , m_mutex()
+  {}
+
+  BufferBinder(const BufferBinder&) = delete;
+
+  BufferBinder&
+  operator=(const BufferBinder&) = delete;
+
+  // Alignment in bytes which host memory needs for kUseHostPtr
+  std::size_t
+  alignment() const noexcept
+  {
+    return m_alignment;
+  }
+
+  bool
+  isAligned(const void* hostPtr) const noexcept
+  {
+    return reinterpret_cast<std::uintptr_t>(hostPtr) % m_alignment == 0;
+  }
+
+  const BindingDecision&
+  choose(const void* hostPtr)
+  {
+    const auto isAlignedPtr = isAligned(hostPtr);
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const auto it = m_decisions.find(isAlignedPtr);
+    if (it != m_decisions.end()) {
+      return it->second;
+    }
+    return m_decisions.emplace(isAlignedPtr, decide(isAlignedPtr)).first->second;
+  }
+
+  /*!
+   * Bind size bytes at hostPtr, which has to outlive the returned buffer.
+   * access is CL_MEM_READ_ONLY, CL_MEM_WRITE_ONLY or CL_MEM_READ_WRITE.
+   */
+  BoundBuffer
+  bind(void* hostPtr, std::size_t size, cl_mem_flags access)
+  {
+    return BoundBuffer{m_context, choose(hostPtr).strategy, access, hostPtr, size};
+  }
+
+private:
+  using Clock = std::chrono::high_resolution_clock;
+
+  BindingDecision
+  decide(bool isAlignedPtr)
+  {
+    auto strategy = BindingStrategy::kCopyHostPtr;
+    if (getBindingStrategyFromEnv(strategy)) {
+      return BindingDecision{strategy, "set by CLSTUDY_BINDING"};
+    }
+
+    const auto alignment = std::to_string(m_alignment) + " bytes";
+    const auto sharedMemory = (m_device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) != 0
+      ? "CPU device"
+      : m_device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE ? "host unified memory" : nullptr;
+    if (sharedMemory != nullptr) {
+      return isAlignedPtr
+        ? BindingDecision{BindingStrategy::kUseHostPtr, std::string{sharedMemory} + ", host pointer aligned to " + alignment + ": used in place"}
+        : BindingDecision{BindingStrategy::kAllocHostPtr, std::string{sharedMemory} + ", host pointer not aligned to " + alignment + ": copied to driver memory once"};
+    }
+
+    if (m_calibration.empty()) {
+      calibrate();
+    }
+    std::ostringstream oss;
+    oss << "calibrated on " << (kCalibrationSize >> 20) << " MiB round trips:";
+    auto isFound = false;
+    for (const auto& entry : m_calibration) {
+      oss << " " << getBindingStrategyName(entry.first) << " ";
+      if (entry.second < 0.0) {
+        oss << "failed";
+        continue;
+      }
+      oss << entry.second * 1.0e3 << " ms";
+      if (entry.first == BindingStrategy::kUseHostPtr && !isAlignedPtr) {
+        oss << " (host pointer not aligned to " << alignment << ")";
+        continue;
+      }
+      if (!isFound || entry.second < m_calibration[strategy]) {
+        strategy = entry.first;
+        isFound = true;
+      }
+    }
+    return BindingDecision{strategy, oss.str()};
+  }
+
+  // Time each strategy; a negative time stands for a failure.
+  void
+  calibrate()
+  {
+    const auto calibrationAlignment = std::max<std::size_t>(m_alignment, 4096);
+    const std::unique_ptr<unsigned char, decltype(&alignedFree)> input{
+      alignedMalloc<unsigned char>(kCalibrationSize, calibrationAlignment),
+      alignedFree};
+    const std::unique_ptr<unsigned char, decltype(&alignedFree)> output{
+      alignedMalloc<unsigned char>(kCalibrationSize, calibrationAlignment),
+      alignedFree};
+    if (input == nullptr || output == nullptr) {
+      throw std::bad_alloc{};
+    }
+    std::memset(input.get(), 1, kCalibrationSize);
+
+    cl::CommandQueue queue{m_context, m_device};
+    for (const auto strategy : {BindingStrategy::kCopyHostPtr, BindingStrategy::kUseHostPtr, BindingStrategy::kAllocHostPtr}) {
+      auto best = -1.0;
+      try {
+        for (int i = 0; i < kCalibrationRepeats; i++) {
+          const auto start = Clock::now();
+          const BoundBuffer src{m_context, strategy, CL_MEM_READ_ONLY, input.get(), kCalibrationSize};
+          const BoundBuffer dst{m_context, strategy, CL_MEM_WRITE_ONLY, output.get(), kCalibrationSize};
+          queue.enqueueCopyBuffer(src, dst, 0, 0, kCalibrationSize);
+          dst.syncToHost(queue);
+          queue.finish();
+          const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+          best = best < 0.0 ? elapsed : std::min(best, elapsed);
+        }
+      } catch (const cl::Error&) {
+        best = -1.0;
+      }
+      m_calibration[strategy] = best;
+    }
+  }
+
+  cl::Context m_context;
+  cl::Device m_device;
+  std::size_t m_alignment;
+  // Keyed by whether the host pointer is aligned
+  std::map<bool, BindingDecision> m_decisions;
+  // Seconds of a calibration round trip per strategy
+  std::map<BindingStrategy, double> m_calibration;
+  std::mutex m_mutex;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_BUFFER_BINDING_HPP
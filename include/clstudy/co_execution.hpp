@@ -0,0 +1,326 @@
+#ifndef CLSTUDY_CO_EXECUTION_HPP
+#define CLSTUDY_CO_EXECUTION_HPP
+
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/host_compute.hpp>
+
+
+namespace clstudy
+{
+
+struct CoExecutionStats
+{
+  // "host" or the name of the device
+  std::string name;
+  std::size_t nElements;
+  std::size_t nChunks;
+  // Wall time from the first chunk taken to the last one completed
+  double seconds;
+
+  double
+  elementsPerSecond() const noexcept
+  {
+    return seconds > 0.0 ? static_cast<double>(nElements) / seconds : 0.0;
+  }
+};
+
+
+struct CoExecutionReport
+{
+  double seconds;
+  // The host first, then the devices in order
+  std::vector<CoExecutionStats> workers;
+};
+
+
+/*!
+ * Splits a range of n work-items between the host and OpenCL devices, which
+ * run at the same time and write into one output.
+ *
+ * The host and every device take chunks from the front of the range until it
+ * is exhausted, so a slower side never holds up a faster one for longer than
+ * one chunk. The size of a chunk follows the throughput of its taker, measured
+ * on its previous chunks and kept across calls of run(): at most the share of
+ * the remaining range that the taker would finish in the time all of them
+ * need, so that the last chunks shrink and everybody finishes together.
+ *
+ * Host chunks are run on the calling thread by hostWork, e.g. with
+ * HostCompute::parallelFor(). Each device gets a thread that keeps two chunks
+ * enqueued by deviceWork on its own in-order queue. deviceWork returns the
+ * event after which the results of the chunk are in the output, e.g. that of
+ * unmapping the chunk the kernel wrote.
+ *
+ * Chunks of different workers run concurrently, and OpenCL leaves concurrent
+ * writes to one buffer from several queues undefined, as well as host access
+ * to a CL_MEM_USE_HOST_PTR buffer which is not mapped. So every chunk has to
+ * work on a sub-buffer of its own range, the kernel of a device chunk as well
+ * as the mapping of a host chunk, e.g. with CL_MAP_WRITE_INVALIDATE_REGION.
+ * Chunks start at multiples of the grain size; getSubBufferGrainSize() gives
+ * one with which they meet the alignment sub-buffers need.
+ */
+class CoExecutionScheduler
+{
+public:
+  // Runs work-items [begin, end) on the host.
+  using HostWork = std::function<void(std::size_t begin, std::size_t end)>;
+  // Enqueues work-items [begin, end) for device on queue.
+  using DeviceWork = std::function<cl::Event(std::size_t device, cl::CommandQueue& queue, std::size_t begin, std::size_t end)>;
+
+  // Chunks per worker a run is aimed at once throughputs are known
+  static constexpr std::size_t kChunksPerWorker = 8;
+  // Weight of the latest chunk in the throughput estimates
+  static constexpr double kSmoothing = 0.5;
+
+  CoExecutionScheduler(
+    const cl::Context& context,
+    const std::vector<cl::Device>& devices,
+    std::size_t grainSize = HostCompute::kMinParallelSize)
+    : m_queues()
+    , m_names{"host"}
+    , m_grainSize(std::max<std::size_t>(1, grainSize))
+    , m_throughputs(devices.size() + 1, 0.0)
+    , m_mutex()
+    , m_cursor(0)
+    , m_size(0)
+    , m_activeWorkers()
+  {
+    for (const auto& device : devices) {
+      m_queues.emplace_back(context, device);
+      m_names.push_back(device.getInfo<CL_DEVICE_NAME>());
+    }
+  }
+
+  CoExecutionScheduler(const CoExecutionScheduler&) = delete;
+
+  CoExecutionScheduler&
+  operator=(const CoExecutionScheduler&) = delete;
+
+  /*!
+   * grainSize rounded up so that chunks of elements of elementSize bytes
+   * start at multiples of CL_DEVICE_MEM_BASE_ADDR_ALIGN of every device, as
+   * clCreateSubBuffer() requires.
+   */
+  static std::size_t
+  getSubBufferGrainSize(
+    const std::vector<cl::Device>& devices,
+    std::size_t elementSize,
+    std::size_t grainSize = HostCompute::kMinParallelSize)
+  {
+    auto size = std::max<std::size_t>(1, grainSize);
+    for (const auto& device : devices) {
+      // The alignment is a power of two, so rounding up to each one in turn
+      // gives a multiple of all of them.
+      const auto alignment = std::max<std::size_t>(1, device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8 / elementSize);
+      size = (size + alignment - 1) / alignment * alignment;
+    }
+    return size;
+  }
+
+  /*!
+   * Run n work-items. An empty hostWork leaves the host out, and an empty
+   * deviceWork the devices, e.g. to measure either side alone.
+   */
+  CoExecutionReport
+  run(std::size_t n, const HostWork& hostWork, const DeviceWork& deviceWork)
+  {
+    if (n > 0 && !hostWork && (!deviceWork || m_queues.empty())) {
+      throw std::invalid_argument{"[CoExecutionScheduler] Neither the host nor a device can run the range."};
+    }
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      m_cursor = 0;
+      m_size = n;
+      m_activeWorkers.assign(m_throughputs.size(), false);
+      m_activeWorkers[0] = static_cast<bool>(hostWork);
+      for (std::size_t d = 0; d < m_queues.size(); d++) {
+        m_activeWorkers[d + 1] = static_cast<bool>(deviceWork);
+      }
+    }
+
+    CoExecutionReport report{0.0, {}};
+    for (const auto& name : m_names) {
+      report.workers.push_back(CoExecutionStats{name, 0, 0, 0.0});
+    }
+
+    const auto start = Clock::now();
+    std::vector<std::future<void>> futures;
+    if (deviceWork) {
+      for (std::size_t d = 0; d < m_queues.size(); d++) {
+        futures.push_back(std::async(std::launch::async, [this, d, &deviceWork, &report] {
+          runDevice(d, deviceWork, report.workers[d + 1]);
+        }));
+      }
+    }
+    std::exception_ptr hostException;
+    if (hostWork) {
+      try {
+        runHost(hostWork, report.workers[0]);
+      } catch (...) {
+        hostException = std::current_exception();
+      }
+    }
+    for (auto& future : futures) {
+      future.wait();
+    }
+    if (hostException) {
+      std::rethrow_exception(hostException);
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return report;
+  }
+
+private:
+  using Clock = std::chrono::high_resolution_clock;
+
+  struct Chunk
+  {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  // Take the next chunk for worker w; empty once the range is exhausted.
+  Chunk
+  takeChunk(std::size_t w)
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const auto remaining = m_size - m_cursor;
+    if (remaining == 0) {
+      return Chunk{m_cursor, m_cursor};
+    }
+
+    auto totalThroughput = 0.0;
+    auto nActive = 0.0;
+    auto isKnown = true;
+    for (std::size_t i = 0; i < m_throughputs.size(); i++) {
+      if (m_activeWorkers[i]) {
+        totalThroughput += m_throughputs[i];
+        nActive += 1.0;
+        isKnown &= m_throughputs[i] > 0.0;
+      }
+    }
+    // Until every worker has been measured, probe with small equal chunks.
+    const auto share = isKnown ? m_throughputs[w] / totalThroughput : 1.0 / nActive;
+    const auto target = isKnown
+      ? static_cast<double>(m_size) * share / static_cast<double>(kChunksPerWorker)
+      : static_cast<double>(m_size) / (nActive * static_cast<double>(kChunksPerWorker * 2));
+    auto size = std::min(static_cast<std::size_t>(target), static_cast<std::size_t>(static_cast<double>(remaining) * share));
+    size = (std::max(size, m_grainSize) + m_grainSize - 1) / m_grainSize * m_grainSize;
+    size = std::min(size, remaining);
+
+    const Chunk chunk{m_cursor, m_cursor + size};
+    m_cursor += size;
+    return chunk;
+  }
+
+  void
+  updateThroughput(std::size_t w, std::size_t nElements, double seconds)
+  {
+    if (seconds <= 0.0) {
+      return;
+    }
+    const auto throughput = static_cast<double>(nElements) / seconds;
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto& estimate = m_throughputs[w];
+    estimate = estimate > 0.0 ? (1.0 - kSmoothing) * estimate + kSmoothing * throughput : throughput;
+  }
+
+  void
+  runHost(const HostWork& hostWork, CoExecutionStats& stats)
+  {
+    const auto start = Clock::now();
+    for (;;) {
+      const auto chunk = takeChunk(0);
+      if (chunk.begin == chunk.end) {
+        break;
+      }
+      const auto chunkStart = Clock::now();
+      hostWork(chunk.begin, chunk.end);
+      updateThroughput(0, chunk.end - chunk.begin, std::chrono::duration<double>(Clock::now() - chunkStart).count());
+      stats.nElements += chunk.end - chunk.begin;
+      stats.nChunks++;
+    }
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  /*!
+   * Keep two chunks in flight, so that the device works on one while the
+   * other is being enqueued. The time of a chunk is measured from the end of
+   * the previous one, or from its enqueueing if the device was idle.
+   */
+  void
+  runDevice(std::size_t d, const DeviceWork& deviceWork, CoExecutionStats& stats)
+  {
+    struct InFlight
+    {
+      Chunk chunk;
+      cl::Event event;
+      Clock::time_point enqueued;
+    };
+
+    constexpr std::size_t kMaxInFlight = 2;
+    auto& queue = m_queues[d];
+    std::deque<InFlight> inFlight;
+    const auto start = Clock::now();
+    auto lastDone = start;
+    auto isExhausted = false;
+    for (;;) {
+      while (!isExhausted && inFlight.size() < kMaxInFlight) {
+        const auto chunk = takeChunk(d + 1);
+        if (chunk.begin == chunk.end) {
+          isExhausted = true;
+          break;
+        }
+        const auto enqueued = Clock::now();
+        auto event = deviceWork(d, queue, chunk.begin, chunk.end);
+        queue.flush();
+        inFlight.push_back(InFlight{chunk, std::move(event), enqueued});
+      }
+      if (inFlight.empty()) {
+        break;
+      }
+
+      auto& front = inFlight.front();
+      front.event.wait();
+      const auto done = Clock::now();
+      const auto size = front.chunk.end - front.chunk.begin;
+      updateThroughput(d + 1, size, std::chrono::duration<double>(done - std::max(lastDone, front.enqueued)).count());
+      lastDone = done;
+      stats.nElements += size;
+      stats.nChunks++;
+      inFlight.pop_front();
+    }
+    queue.finish();
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  std::vector<cl::CommandQueue> m_queues;
+  std::vector<std::string> m_names;
+  std::size_t m_grainSize;
+  // Elements per second of the host and the devices; 0 if not measured yet
+  std::vector<double> m_throughputs;
+  std::mutex m_mutex;
+  std::size_t m_cursor;
+  std::size_t m_size;
+  std::vector<bool> m_activeWorkers;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_CO_EXECUTION_HPP
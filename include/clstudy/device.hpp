@@ -0,0 +1,125 @@
+#ifndef CLSTUDY_DEVICE_HPP
+#define CLSTUDY_DEVICE_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <config/opencl.hpp>
+
+
+namespace clstudy
+{
+
+/*!
+ * Device type selected by the environment variable CLSTUDY_DEVICE_TYPE, which
+ * is one of "gpu", "cpu", "accelerator", "default" and "all".
+ * Returns defaultType when it is not set, e.g. so that a sample written for a
+ * GPU can be run on a CPU-only implementation such as POCL.
+ */
+inline cl_device_type
+getDeviceTypeFromEnv(cl_device_type defaultType = CL_DEVICE_TYPE_GPU)
+{
+  const auto value = std::getenv("CLSTUDY_DEVICE_TYPE");
+  if (value == nullptr || value[0] == '\0') {
+    return defaultType;
+  }
+
+  const std::string name{value};
+  if (name == "gpu") {
+    return CL_DEVICE_TYPE_GPU;
+  } else if (name == "cpu") {
+    return CL_DEVICE_TYPE_CPU;
+  } else if (name == "accelerator") {
+    return CL_DEVICE_TYPE_ACCELERATOR;
+  } else if (name == "default") {
+    return CL_DEVICE_TYPE_DEFAULT;
+  } else if (name == "all") {
+    return CL_DEVICE_TYPE_ALL;
+  }
+  throw std::runtime_error{"Unknown CLSTUDY_DEVICE_TYPE: " + name};
+}
+
+
+// Whether CL_DEVICE_EXTENSIONS of device lists extension.
+inline bool
+hasExtension(const cl::Device& device, const std::string& extension)
+{
+  const auto extensions = " " + device.getInfo<CL_DEVICE_EXTENSIONS>() + " ";
+  return extensions.find(" " + extension + " ") != std::string::npos;
+}
+
+
+// Major version of CL_DEVICE_OPENCL_C_VERSION, "OpenCL C <major>.<minor> ...".
+inline int
+getOpenCLCMajorVersion(const cl::Device& device)
+{
+  constexpr std::size_t kPrefixLength = 9;
+  const auto version = device.getInfo<CL_DEVICE_OPENCL_C_VERSION>();
+  return version.size() > kPrefixLength ? std::atoi(version.c_str() + kPrefixLength) : 0;
+}
+
+
+/*!
+ * Whether kernels on device can call enqueue_kernel(), which needs OpenCL C 2.0
+ * and an on-device queue. Devices of OpenCL 3.0 without the feature report a
+ * CL_DEVICE_QUEUE_ON_DEVICE_MAX_SIZE of 0.
+ */
+inline bool
+isDeviceEnqueueSupported(const cl::Device& device)
+{
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+  return getOpenCLCMajorVersion(device) >= 2
+    && device.getInfo<CL_DEVICE_QUEUE_ON_DEVICE_MAX_SIZE>() > 0;
+#else
+  static_cast<void>(device);
+  return false;
+#endif  // CL_HPP_TARGET_OPENCL_VERSION >= 200
+}
+
+
+/*!
+ * Whether kernels on device can use pipes, which needs OpenCL C 2.0. Devices
+ * of OpenCL 3.0 without the feature report a CL_DEVICE_PIPE_MAX_PACKET_SIZE
+ * of 0.
+ */
+inline bool
+isPipeSupported(const cl::Device& device)
+{
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+  return getOpenCLCMajorVersion(device) >= 2
+    && device.getInfo<CL_DEVICE_PIPE_MAX_PACKET_SIZE>() > 0;
+#else
+  static_cast<void>(device);
+  return false;
+#endif  // CL_HPP_TARGET_OPENCL_VERSION >= 200
+}
+
+
+/*!
+ * CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT of device, rounded down to one of the
+ * OpenCL C vector sizes 1, 2, 4, 8 and 16.
+ * The environment variable CLSTUDY_VECTOR_WIDTH overrides the query, e.g. to
+ * compare a vectorized kernel with the scalar one.
+ */
+inline cl_uint
+getPreferredFloatVectorWidth(const cl::Device& device)
+{
+  cl_uint width = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>();
+  const auto value = std::getenv("CLSTUDY_VECTOR_WIDTH");
+  if (value != nullptr && value[0] != '\0') {
+    width = static_cast<cl_uint>(std::stoul(value));
+  }
+
+  cl_uint result = 1;
+  while (result < 16 && result * 2 <= width) {
+    result *= 2;
+  }
+  return result;
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_DEVICE_HPP
@@ -0,0 +1,472 @@
+#ifndef CLSTUDY_DEVICE_ARENA_HPP
+#define CLSTUDY_DEVICE_ARENA_HPP
+
+#include <cstddef>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+
+
+namespace clstudy
+{
+
+class DeviceArena;
+
+
+struct DeviceArenaStats
+{
+  // Bytes of all blocks
+  std::size_t reservedBytes;
+  // Bytes of the live allocations and of those whose release is pending,
+  // rounded up to the alignment
+  std::size_t usedBytes;
+  // Maximum of usedBytes so far
+  std::size_t highWaterBytes;
+  std::size_t freeBytes;
+  std::size_t largestFreeBytes;
+  std::size_t nAllocations;
+  std::size_t nBlocks;
+
+  /*!
+   * Share of the free bytes which are not in the largest free range: 0 if the
+   * free space is contiguous, close to 1 if it is scattered in small pieces.
+   */
+  double
+  fragmentation() const noexcept
+  {
+    return freeBytes == 0 ? 0.0 : 1.0 - static_cast<double>(largestFreeBytes) / static_cast<double>(freeBytes);
+  }
+};
+
+
+/*!
+ * A sub-buffer of a DeviceArena, given back to the arena on destruction or
+ * release(). It converts to cl::Buffer, and can be passed to
+ * cl::Kernel::setArg() directly. The arena has to outlive it.
+ *
+ * Destruction and release() free the range at once, so the commands which use
+ * the sub-buffer have to be completed by then; otherwise the range may be
+ * handed out again while they still access it. release(waitList) frees it
+ * only once the events of waitList have completed instead.
+ */
+class DeviceAllocation
+{
+public:
+  DeviceAllocation() noexcept
+    : m_arena(nullptr)
+    , m_block(nullptr)
+    , m_buffer()
+    , m_offset(0)
+    , m_size(0)
+    , m_reservedSize(0)
+  {}
+
+  DeviceAllocation(const DeviceAllocation&) = delete;
+
+  DeviceAllocation&
+  operator=(const DeviceAllocation&) = delete;
+
+  DeviceAllocation(DeviceAllocation&& other) noexcept
+    : m_arena(std::exchange(other.m_arena, nullptr))
+    , m_block(std::exchange(other.m_block, nullptr))
+    , m_buffer(std::move(other.m_buffer))
+    , m_offset(std::exchange(other.m_offset, 0))
+    , m_size(std::exchange(other.m_size, 0))
+    , m_reservedSize(std::exchange(other.m_reservedSize, 0))
+  {}
+
+  DeviceAllocation&
+  operator=(DeviceAllocation&& other) noexcept
+  {
+    if (this != &other) {
+      release();
+      m_arena = std::exchange(other.m_arena, nullptr);
+      m_block = std::exchange(other.m_block, nullptr);
+      m_buffer = std::move(other.m_buffer);
+      m_offset = std::exchange(other.m_offset, 0);
+      m_size = std::exchange(other.m_size, 0);
+      m_reservedSize = std::exchange(other.m_reservedSize, 0);
+    }
+    return *this;
+  }
+
+  ~DeviceAllocation()
+  {
+    release();
+  }
+
+  explicit operator bool() const noexcept
+  {
+    return m_block != nullptr;
+  }
+
+  const cl::Buffer&
+  buffer() const noexcept
+  {
+    return m_buffer;
+  }
+
+  operator const cl::Buffer&() const noexcept
+  {
+    return m_buffer;
+  }
+
+  // Offset of the sub-buffer in its block
+  std::size_t
+  offset() const noexcept
+  {
+    return m_offset;
+  }
+
+  // Bytes requested from allocate()
+  std::size_t
+  size() const noexcept
+  {
+    return m_size;
+  }
+
+  // Give the range back to the arena at once; the allocation is empty afterwards.
+  void
+  release() noexcept;
+
+  /*!
+   * Give the range back to the arena once the commands of waitList, e.g. the
+   * kernels which use the sub-buffer, have completed; the allocation is empty
+   * afterwards.
+   */
+  void
+  release(std::vector<cl::Event> waitList);
+
+private:
+  friend class DeviceArena;
+
+  struct Block;
+
+  DeviceAllocation(
+    DeviceArena* arena,
+    Block* block,
+    cl::Buffer buffer,
+    std::size_t offset,
+    std::size_t size,
+    std::size_t reservedSize) noexcept
+    : m_arena(arena)
+    , m_block(block)
+    , m_buffer(std::move(buffer))
+    , m_offset(offset)
+    , m_size(size)
+    , m_reservedSize(reservedSize)
+  {}
+
+  DeviceArena* m_arena;
+  Block* m_block;
+  cl::Buffer m_buffer;
+  std::size_t m_offset;
+  std::size_t m_size;
+  std::size_t m_reservedSize;
+};
+
+
+// A buffer of the arena with its free ranges
+struct DeviceAllocation::Block
+{
+  cl::Buffer buffer;
+  std::size_t size;
+  // Offset to size of each free range; adjacent ranges are merged
+  std::map<std::size_t, std::size_t> freeRanges;
+};
+
+
+/*!
+ * Allocator of device memory which creates a few large buffers and hands out
+ * sub-buffers of them, so that many short-lived allocations cost neither a
+ * clCreateBuffer() each nor fragment the memory of the device.
+ *
+ * Sub-buffers start at multiples of CL_DEVICE_MEM_BASE_ADDR_ALIGN of the
+ * device, as clCreateSubBuffer() requires, and their sizes are rounded up to
+ * it. A request takes the smallest free range which fits it, the best fit of
+ * the free list of every block; freed ranges are merged with their free
+ * neighbors. A new block of blockSize bytes, or of the request if that is
+ * larger, is created only if no range fits. Ranges released with a wait list
+ * are taken back by allocate() and shrink() once their events have completed.
+ * Thread-safe.
+ */
+class DeviceArena
+{
+public:
+  static constexpr std::size_t kDefaultBlockSize = 64 * 1024 * 1024;
+
+  /*!
+   * flags are those of the blocks, e.g. CL_MEM_READ_WRITE. blockSize is
+   * limited to CL_DEVICE_MAX_MEM_ALLOC_SIZE.
+   */
+  DeviceArena(
+    cl::Context context,
+    const cl::Device& device,
+    std::size_t blockSize = kDefaultBlockSize,
+    cl_mem_flags flags = CL_MEM_READ_WRITE)
+    : m_context(std::move(context))
+    , m_flags(flags)
+    , m_alignment(std::max<std::size_t>(1, device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8))
+    , m_maxBlockSize(std::min<cl_ulong>(device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>(), std::numeric_limits<std::size_t>::max()) / m_alignment * m_alignment)
+    , m_blockSize(std::min(roundUp(std::max<std::size_t>(1, blockSize)), m_maxBlockSize))
+    , m_mutex()
+    , m_blocks()
+    , m_pendingRanges()
+    , m_stats{0, 0, 0, 0, 0, 0, 0}
+  {}
+
+  DeviceArena(const DeviceArena&) = delete;
+
+  DeviceArena&
+  operator=(const DeviceArena&) = delete;
+
+  // Alignment of every sub-buffer in bytes
+  std::size_t
+  alignment() const noexcept
+  {
+    return m_alignment;
+  }
+
+  /*!
+   * Allocate a sub-buffer of size bytes. flags may restrict the access of the
+   * blocks, e.g. to CL_MEM_READ_ONLY; 0 inherits it.
+   */
+  DeviceAllocation
+  allocate(std::size_t size, cl_mem_flags flags = 0)
+  {
+    if (size == 0) {
+      throw std::invalid_argument{"[DeviceArena] Cannot allocate zero bytes."};
+    }
+    const auto reservedSize = roundUp(size);
+    if (reservedSize > m_maxBlockSize) {
+      throw std::length_error{"[DeviceArena] Allocation exceeds CL_DEVICE_MAX_MEM_ALLOC_SIZE."};
+    }
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    reclaimPendingRanges();
+    DeviceAllocation::Block* bestBlock = nullptr;
+    auto bestRange = std::map<std::size_t, std::size_t>::iterator{};
+    for (const auto& block : m_blocks) {
+      for (auto it = std::begin(block->freeRanges); it != std::end(block->freeRanges); ++it) {
+        if (it->second >= reservedSize && (bestBlock == nullptr || it->second < bestRange->second)) {
+          bestBlock = block.get();
+          bestRange = it;
+        }
+      }
+    }
+    if (bestBlock == nullptr) {
+      const auto blockSize = std::max(m_blockSize, reservedSize);
+      m_blocks.push_back(std::unique_ptr<DeviceAllocation::Block>{new DeviceAllocation::Block{
+        cl::Buffer{m_context, m_flags, blockSize},
+        blockSize,
+        {{0, blockSize}}}});
+      m_stats.reservedBytes += blockSize;
+      m_stats.nBlocks++;
+      bestBlock = m_blocks.back().get();
+      bestRange = std::begin(bestBlock->freeRanges);
+    }
+
+    const auto offset = bestRange->first;
+    const cl_buffer_region region{offset, size};
+    auto subBuffer = bestBlock->buffer.createSubBuffer(flags, CL_BUFFER_CREATE_TYPE_REGION, &region);
+    const auto rest = bestRange->second - reservedSize;
+    bestBlock->freeRanges.erase(bestRange);
+    if (rest > 0) {
+      bestBlock->freeRanges.emplace(offset + reservedSize, rest);
+    }
+    m_stats.usedBytes += reservedSize;
+    m_stats.highWaterBytes = std::max(m_stats.highWaterBytes, m_stats.usedBytes);
+    m_stats.nAllocations++;
+    return DeviceAllocation{this, bestBlock, std::move(subBuffer), offset, size, reservedSize};
+  }
+
+  // Release the blocks without live allocations or pending releases.
+  void
+  shrink()
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    reclaimPendingRanges();
+    const auto it = std::stable_partition(std::begin(m_blocks), std::end(m_blocks), [](const auto& block) {
+      return block->freeRanges.size() != 1 || block->freeRanges.begin()->second != block->size;
+    });
+    std::for_each(it, std::end(m_blocks), [this](const auto& block) {
+      m_stats.reservedBytes -= block->size;
+      m_stats.nBlocks--;
+    });
+    m_blocks.erase(it, std::end(m_blocks));
+  }
+
+  DeviceArenaStats
+  stats() const
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto stats = m_stats;
+    for (const auto& block : m_blocks) {
+      for (const auto& range : block->freeRanges) {
+        stats.freeBytes += range.second;
+        stats.largestFreeBytes = std::max(stats.largestFreeBytes, range.second);
+      }
+    }
+    return stats;
+  }
+
+private:
+  friend class DeviceAllocation;
+
+  // A released range which is freed once its wait list has completed
+  struct PendingRange
+  {
+    DeviceAllocation::Block* block;
+    std::size_t offset;
+    std::size_t size;
+    std::vector<cl::Event> waitList;
+  };
+
+  std::size_t
+  roundUp(std::size_t size) const noexcept
+  {
+    return (size + m_alignment - 1) / m_alignment * m_alignment;
+  }
+
+  static bool
+  isCompleted(const std::vector<cl::Event>& waitList)
+  {
+    return std::all_of(std::cbegin(waitList), std::cend(waitList), [](const auto& event) {
+      // A negative status is an error, after which the command will not run.
+      return event.template getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() <= CL_COMPLETE;
+    });
+  }
+
+  void
+  release(DeviceAllocation::Block* block, std::size_t offset, std::size_t size) noexcept
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    freeRange(block, offset, size);
+  }
+
+  void
+  release(DeviceAllocation::Block* block, std::size_t offset, std::size_t size, std::vector<cl::Event> waitList)
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_pendingRanges.push_back(PendingRange{block, offset, size, std::move(waitList)});
+  }
+
+  // Free the pending ranges whose wait lists have completed; m_mutex is held.
+  void
+  reclaimPendingRanges()
+  {
+    const auto it = std::stable_partition(std::begin(m_pendingRanges), std::end(m_pendingRanges), [](const auto& range) {
+      return !isCompleted(range.waitList);
+    });
+    std::for_each(it, std::end(m_pendingRanges), [this](const auto& range) {
+      freeRange(range.block, range.offset, range.size);
+    });
+    m_pendingRanges.erase(it, std::end(m_pendingRanges));
+  }
+
+  // Merge a range into the free list of its block; m_mutex is held.
+  void
+  freeRange(DeviceAllocation::Block* block, std::size_t offset, std::size_t size) noexcept
+  {
+    m_stats.usedBytes -= size;
+    m_stats.nAllocations--;
+    auto& ranges = block->freeRanges;
+    auto next = ranges.lower_bound(offset);
+    if (next != std::end(ranges) && offset + size == next->first) {
+      size += next->second;
+      next = ranges.erase(next);
+    }
+    if (next != std::begin(ranges)) {
+      const auto prev = std::prev(next);
+      if (prev->first + prev->second == offset) {
+        prev->second += size;
+        size = 0;
+      }
+    }
+    if (size > 0) {
+      ranges.emplace_hint(next, offset, size);
+    }
+  }
+
+  cl::Context m_context;
+  cl_mem_flags m_flags;
+  std::size_t m_alignment;
+  std::size_t m_maxBlockSize;
+  std::size_t m_blockSize;
+  mutable std::mutex m_mutex;
+  std::vector<std::unique_ptr<DeviceAllocation::Block>> m_blocks;
+  std::vector<PendingRange> m_pendingRanges;
+  // freeBytes and largestFreeBytes are computed by stats()
+  DeviceArenaStats m_stats;
+};
+
+
+inline void
+DeviceAllocation::release() noexcept
+{
+  if (m_block != nullptr) {
+    // The sub-buffer goes first, although it would keep the block alive.
+    m_buffer = cl::Buffer{};
+    m_arena->release(m_block, m_offset, m_reservedSize);
+    m_arena = nullptr;
+    m_block = nullptr;
+    m_offset = 0;
+    m_size = 0;
+    m_reservedSize = 0;
+  }
+}
+
+
+inline void
+DeviceAllocation::release(std::vector<cl::Event> waitList)
+{
+  if (m_block != nullptr) {
+    m_arena->release(m_block, m_offset, m_reservedSize, std::move(waitList));
+    m_buffer = cl::Buffer{};
+    m_arena = nullptr;
+    m_block = nullptr;
+    m_offset = 0;
+    m_size = 0;
+    m_reservedSize = 0;
+  }
+}
+
+}  // namespace clstudy
+
+
+namespace cl
+{
+namespace detail
+{
+
+// Pass a DeviceAllocation to cl::Kernel::setArg() as its sub-buffer; the
+// generic handler would pass the bytes of the object itself.
+template<>
+struct KernelArgumentHandler<clstudy::DeviceAllocation>
+{
+  static std::size_t
+  size(const clstudy::DeviceAllocation&)
+  {
+    return sizeof(cl_mem);
+  }
+
+  static const cl_mem*
+  ptr(const clstudy::DeviceAllocation& value)
+  {
+    return &value.buffer()();
+  }
+};
+
+}  // namespace detail
+}  // namespace cl
+
+
+#endif  // CLSTUDY_DEVICE_ARENA_HPP
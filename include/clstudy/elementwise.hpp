@@ -0,0 +1,421 @@
+#ifndef CLSTUDY_ELEMENTWISE_HPP
+#define CLSTUDY_ELEMENTWISE_HPP
+
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/program_cache.hpp>
+
+
+namespace clstudy
+{
+
+class ElementwiseEngine;
+
+
+/*!
+ * Collects the kernel parameters while an expression is turned into OpenCL C.
+ * Every leaf of the expression becomes one parameter x0, x1, ... in the order
+ * of appearance, which matches the order of the tuple returned by args().
+ */
+struct ElementwiseSignature
+{
+  ElementwiseSignature()
+    : params()
+    , nParams(0)
+  {}
+
+  // typePrefix is the declaration up to the parameter name, e.g. "float ".
+  std::string
+  addParam(const std::string& typePrefix)
+  {
+    auto name = "x" + std::to_string(nParams++);
+    params += ",\n    " + typePrefix + name;
+    return name;
+  }
+
+  std::string params;
+  int nParams;
+};
+
+
+/*!
+ * CRTP base of the elementwise expressions over float buffers.
+ *
+ * Every expression E provides
+ *   std::string emit(ElementwiseSignature&) const  OpenCL C text of element i
+ *   std::tuple<...> args() const                   kernel arguments of leaves
+ *   void checkSize(std::size_t) const              throws on size mismatch
+ */
+template<typename E>
+class ElementwiseExpr
+{
+public:
+  const E&
+  derived() const noexcept
+  {
+    return static_cast<const E&>(*this);
+  }
+};
+
+
+/*!
+ * A float buffer taking part in elementwise expressions.
+ * Assigning an expression to it launches one fused kernel on the queue of its
+ * engine, e.g. c = a * b + alpha * d.
+ *
+ * Assignment always writes the elements, also from another DeviceVector. So
+ * it is not copyable, which would share the buffer instead; a second handle
+ * of the same buffer has to be made explicitly with
+ * ElementwiseEngine::vector(buffer()).
+ */
+class DeviceVector : public ElementwiseExpr<DeviceVector>
+{
+public:
+  DeviceVector(ElementwiseEngine& engine, cl::Buffer buffer, std::size_t size)
+    : m_engine(&engine)
+    , m_buffer(std::move(buffer))
+    , m_size(size)
+  {}
+
+  DeviceVector(const DeviceVector&) = delete;
+
+  DeviceVector(DeviceVector&&) = default;
+
+  // Copies the elements, not the handle; rvalues as well, since there is no
+  // move assignment.
+  DeviceVector&
+  operator=(const DeviceVector& other);
+
+  template<typename E>
+  DeviceVector&
+  operator=(const ElementwiseExpr<E>& expr);
+
+  const cl::Buffer&
+  buffer() const noexcept
+  {
+    return m_buffer;
+  }
+
+  std::size_t
+  size() const noexcept
+  {
+    return m_size;
+  }
+
+  std::string
+  emit(ElementwiseSignature& signature) const
+  {
+    return signature.addParam("__global const float *") + "[i]";
+  }
+
+  std::tuple<const cl::Buffer&>
+  args() const noexcept
+  {
+    return std::tuple<const cl::Buffer&>{m_buffer};
+  }
+
+  void
+  checkSize(std::size_t size) const
+  {
+    if (m_size != size) {
+      throw std::invalid_argument{
+        "[DeviceVector] Size mismatch: " + std::to_string(m_size) + " != " + std::to_string(size)};
+    }
+  }
+
+private:
+  ElementwiseEngine* m_engine;
+  cl::Buffer m_buffer;
+  std::size_t m_size;
+};
+
+
+// A scalar operand, passed as a kernel argument so that its value does not
+// change the generated source.
+class ElementwiseScalar : public ElementwiseExpr<ElementwiseScalar>
+{
+public:
+  explicit ElementwiseScalar(float value) noexcept
+    : m_value(value)
+  {}
+
+  std::string
+  emit(ElementwiseSignature& signature) const
+  {
+    return signature.addParam("float ");
+  }
+
+  std::tuple<float>
+  args() const noexcept
+  {
+    return std::tuple<float>{m_value};
+  }
+
+  void
+  checkSize(std::size_t /* size */) const noexcept
+  {}
+
+private:
+  float m_value;
+};
+
+
+// Leaves are held by reference and temporaries of inner nodes by value.
+template<typename E>
+struct ElementwiseStorage
+{
+  using type = E;
+};
+
+template<>
+struct ElementwiseStorage<DeviceVector>
+{
+  using type = const DeviceVector&;
+};
+
+
+template<
+  typename TOp,
+  typename L,
+  typename R
+>
+class ElementwiseBinaryExpr : public ElementwiseExpr<ElementwiseBinaryExpr<TOp, L, R>>
+{
+public:
+  ElementwiseBinaryExpr(const L& lhs, const R& rhs)
+    : m_lhs(lhs)
+    , m_rhs(rhs)
+  {}
+
+  std::string
+  emit(ElementwiseSignature& signature) const
+  {
+    auto lhs = m_lhs.emit(signature);
+    auto rhs = m_rhs.emit(signature);
+    return "(" + lhs + " " + TOp::kSymbol + " " + rhs + ")";
+  }
+
+  auto
+  args() const
+  {
+    return std::tuple_cat(m_lhs.args(), m_rhs.args());
+  }
+
+  void
+  checkSize(std::size_t size) const
+  {
+    m_lhs.checkSize(size);
+    m_rhs.checkSize(size);
+  }
+
+private:
+  typename ElementwiseStorage<L>::type m_lhs;
+  typename ElementwiseStorage<R>::type m_rhs;
+};
+
+
+struct ElementwiseAdd
+{
+  static constexpr const char* kSymbol = "+";
+};
+
+struct ElementwiseSub
+{
+  static constexpr const char* kSymbol = "-";
+};
+
+struct ElementwiseMul
+{
+  static constexpr const char* kSymbol = "*";
+};
+
+struct ElementwiseDiv
+{
+  static constexpr const char* kSymbol = "/";
+};
+
+
+#define CLSTUDY_DEFINE_ELEMENTWISE_OPERATOR(op, TOp) \
+  template< \
+    typename L, \
+    typename R \
+  > \
+  inline ElementwiseBinaryExpr<TOp, L, R> \
+  operator op(const ElementwiseExpr<L>& lhs, const ElementwiseExpr<R>& rhs) \
+  { \
+    return {lhs.derived(), rhs.derived()}; \
+  } \
+  \
+  template<typename R> \
+  inline ElementwiseBinaryExpr<TOp, ElementwiseScalar, R> \
+  operator op(float lhs, const ElementwiseExpr<R>& rhs) \
+  { \
+    return {ElementwiseScalar{lhs}, rhs.derived()}; \
+  } \
+  \
+  template<typename L> \
+  inline ElementwiseBinaryExpr<TOp, L, ElementwiseScalar> \
+  operator op(const ElementwiseExpr<L>& lhs, float rhs) \
+  { \
+    return {lhs.derived(), ElementwiseScalar{rhs}}; \
+  }
+
+CLSTUDY_DEFINE_ELEMENTWISE_OPERATOR(+, ElementwiseAdd)
+CLSTUDY_DEFINE_ELEMENTWISE_OPERATOR(-, ElementwiseSub)
+CLSTUDY_DEFINE_ELEMENTWISE_OPERATOR(*, ElementwiseMul)
+CLSTUDY_DEFINE_ELEMENTWISE_OPERATOR(/, ElementwiseDiv)
+
+#undef CLSTUDY_DEFINE_ELEMENTWISE_OPERATOR
+
+
+/*!
+ * Generates, builds and launches fused kernels for elementwise expressions.
+ *
+ * The whole right-hand side of an assignment is emitted as one kernel, so no
+ * intermediate buffer is allocated. Kernels are memoized by their generated
+ * source, which only depends on the shape of the expression, and compiled
+ * through buildCachedProgram() as "elementwise.<key>.bc".
+ *
+ * An engine is bound to one context and queue, and is not thread-safe.
+ */
+class ElementwiseEngine
+{
+public:
+  ElementwiseEngine(
+    cl::Context context,
+    std::vector<cl::Device> devices,
+    cl::CommandQueue queue)
+    : m_context(std::move(context))
+    , m_devices(std::move(devices))
+    , m_queue(std::move(queue))
+    , m_kernels()
+  {}
+
+  ElementwiseEngine(const ElementwiseEngine&) = delete;
+
+  ElementwiseEngine&
+  operator=(const ElementwiseEngine&) = delete;
+
+  DeviceVector
+  vector(cl::Buffer buffer, std::size_t size)
+  {
+    return DeviceVector{*this, std::move(buffer), size};
+  }
+
+  DeviceVector
+  vector(cl::Buffer buffer)
+  {
+    const auto size = buffer.getInfo<CL_MEM_SIZE>() / sizeof(float);
+    return DeviceVector{*this, std::move(buffer), size};
+  }
+
+  template<typename E>
+  cl::Event
+  assign(const DeviceVector& out, const ElementwiseExpr<E>& expr)
+  {
+    const auto& e = expr.derived();
+    e.checkSize(out.size());
+    const auto args = e.args();
+    return launch(
+      getKernel(generateSource(e)),
+      out,
+      args,
+      std::make_index_sequence<std::tuple_size<decltype(args)>::value>{});
+  }
+
+  template<typename E>
+  static std::string
+  generateSource(const ElementwiseExpr<E>& expr)
+  {
+    ElementwiseSignature signature;
+    const auto body = expr.derived().emit(signature);
+    return "__kernel void\n"
+      "elementwise(\n"
+      "    __global float *y" + signature.params + ",\n"
+      "    uint n)\n"
+      "{\n"
+      "  const uint i = get_global_id(0);\n"
+      "  if (i < n) {\n"
+      "    y[i] = " + body + ";\n"
+      "  }\n"
+      "}\n";
+  }
+
+  // Number of memoized kernels.
+  std::size_t
+  size() const noexcept
+  {
+    return m_kernels.size();
+  }
+
+private:
+  cl::Kernel
+  getKernel(const std::string& source)
+  {
+    const auto it = m_kernels.find(source);
+    if (it != m_kernels.end()) {
+      return it->second;
+    }
+    const auto program = buildCachedProgram(
+      "elementwise",
+      ProgramSource{source, {}},
+      m_context,
+      m_devices);
+    cl::Kernel kernel{program, "elementwise"};
+    m_kernels.emplace(source, kernel);
+    return kernel;
+  }
+
+  template<
+    typename... Ts,
+    std::size_t... kIndices
+  >
+  cl::Event
+  launch(
+    const cl::Kernel& kernel,
+    const DeviceVector& out,
+    const std::tuple<Ts...>& args,
+    std::index_sequence<kIndices...>)
+  {
+    cl::KernelFunctor<const cl::Buffer&, Ts..., cl_uint> kernelFunc{kernel};
+    return kernelFunc(
+      cl::EnqueueArgs{m_queue, cl::NDRange{out.size()}},
+      out.buffer(),
+      std::get<kIndices>(args)...,
+      static_cast<cl_uint>(out.size()));
+  }
+
+  cl::Context m_context;
+  std::vector<cl::Device> m_devices;
+  cl::CommandQueue m_queue;
+  std::map<std::string, cl::Kernel> m_kernels;
+};
+
+
+inline DeviceVector&
+DeviceVector::operator=(const DeviceVector& other)
+{
+  m_engine->assign(*this, other);
+  return *this;
+}
+
+
+template<typename E>
+inline DeviceVector&
+DeviceVector::operator=(const ElementwiseExpr<E>& expr)
+{
+  m_engine->assign(*this, expr);
+  return *this;
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_ELEMENTWISE_HPP
@@ -0,0 +1,181 @@
+#ifndef CLSTUDY_HALF_HPP
+#define CLSTUDY_HALF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define CLSTUDY_F16C_RUNTIME_DISPATCH
+#elif defined(_MSC_VER) && defined(__AVX2__)
+#  include <immintrin.h>
+#  define CLSTUDY_F16C_ALWAYS
+#endif  // defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <config/opencl.hpp>
+
+
+namespace clstudy
+{
+
+// IEEE 754 binary32 to binary16, rounding to nearest even.
+inline cl_half
+floatToHalf(float value) noexcept
+{
+  std::uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  const std::uint32_t sign = (x >> 16) & 0x8000u;
+  const std::uint32_t absX = x & 0x7fffffffu;
+
+  if (absX >= 0x7f800000u) {
+    // Inf stays Inf, NaN stays a quiet NaN
+    return static_cast<cl_half>(sign | 0x7c00u | (absX > 0x7f800000u ? 0x0200u | ((absX >> 13) & 0x03ffu) : 0u));
+  }
+  if (absX >= 0x477ff000u) {
+    // Rounds to 65520 or more, which is out of range
+    return static_cast<cl_half>(sign | 0x7c00u);
+  }
+  if (absX < 0x38800000u) {
+    // Subnormal or zero in binary16, below 2^-14
+    if (absX < 0x33000000u) {
+      return static_cast<cl_half>(sign);
+    }
+    const std::uint32_t shift = 126u - (absX >> 23);
+    const std::uint32_t mantissa = (absX & 0x007fffffu) | 0x00800000u;
+    std::uint32_t h = mantissa >> shift;
+    const std::uint32_t rem = mantissa & ((1u << shift) - 1u);
+    const std::uint32_t halfway = 1u << (shift - 1u);
+    if (rem > halfway || (rem == halfway && (h & 1u) != 0)) {
+      h++;
+    }
+    return static_cast<cl_half>(sign | h);
+  }
+
+  // Rebias the exponent from 127 to 15 and drop 13 bits of the mantissa;
+  // a carry out of the mantissa correctly bumps the exponent.
+  std::uint32_t h = (absX - 0x38000000u) >> 13;
+  const std::uint32_t rem = absX & 0x1fffu;
+  if (rem > 0x1000u || (rem == 0x1000u && (h & 1u) != 0)) {
+    h++;
+  }
+  return static_cast<cl_half>(sign | h);
+}
+
+
+inline float
+halfToFloat(cl_half value) noexcept
+{
+  const std::uint32_t sign = (value & 0x8000u) << 16;
+  std::uint32_t exponent = (value >> 10) & 0x1fu;
+  std::uint32_t mantissa = value & 0x03ffu;
+
+  std::uint32_t x;
+  if (exponent == 0x1fu) {
+    // Inf, or NaN made quiet as F16C does
+    x = sign | 0x7f800000u | (mantissa << 13) | (mantissa != 0 ? 0x00400000u : 0u);
+  } else if (exponent != 0) {
+    x = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    x = sign;
+  } else {
+    // Normalize a subnormal
+    exponent = 113;
+    while ((mantissa & 0x0400u) == 0) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    x = sign | (exponent << 23) | ((mantissa & 0x03ffu) << 13);
+  }
+
+  float result;
+  std::memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+
+#if defined(CLSTUDY_F16C_RUNTIME_DISPATCH) || defined(CLSTUDY_F16C_ALWAYS)
+#  ifdef CLSTUDY_F16C_RUNTIME_DISPATCH
+__attribute__((target("avx,f16c")))
+#  endif  // CLSTUDY_F16C_RUNTIME_DISPATCH
+inline void
+convertFloatToHalfF16c(const float* src, cl_half* dst, std::size_t n) noexcept
+{
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const auto v = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    std::memcpy(dst + i, &v, sizeof(v));
+  }
+  for (; i < n; i++) {
+    dst[i] = floatToHalf(src[i]);
+  }
+}
+
+
+#  ifdef CLSTUDY_F16C_RUNTIME_DISPATCH
+__attribute__((target("avx,f16c")))
+#  endif  // CLSTUDY_F16C_RUNTIME_DISPATCH
+inline void
+convertHalfToFloatF16c(const cl_half* src, float* dst, std::size_t n) noexcept
+{
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v;
+    std::memcpy(&v, src + i, sizeof(v));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(v));
+  }
+  for (; i < n; i++) {
+    dst[i] = halfToFloat(src[i]);
+  }
+}
+#endif  // defined(CLSTUDY_F16C_RUNTIME_DISPATCH) || defined(CLSTUDY_F16C_ALWAYS)
+
+
+// Whether the conversions below use the F16C instructions.
+inline bool
+isF16cAvailable() noexcept
+{
+#if defined(CLSTUDY_F16C_ALWAYS)
+  return true;
+#elif defined(CLSTUDY_F16C_RUNTIME_DISPATCH)
+  static const bool isAvailable = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+  return isAvailable;
+#else
+  return false;
+#endif  // defined(CLSTUDY_F16C_ALWAYS)
+}
+
+
+inline void
+convertFloatToHalf(const float* src, cl_half* dst, std::size_t n) noexcept
+{
+#if defined(CLSTUDY_F16C_RUNTIME_DISPATCH) || defined(CLSTUDY_F16C_ALWAYS)
+  if (isF16cAvailable()) {
+    convertFloatToHalfF16c(src, dst, n);
+    return;
+  }
+#endif  // defined(CLSTUDY_F16C_RUNTIME_DISPATCH) || defined(CLSTUDY_F16C_ALWAYS)
+  for (std::size_t i = 0; i < n; i++) {
+    dst[i] = floatToHalf(src[i]);
+  }
+}
+
+
+inline void
+convertHalfToFloat(const cl_half* src, float* dst, std::size_t n) noexcept
+{
+#if defined(CLSTUDY_F16C_RUNTIME_DISPATCH) || defined(CLSTUDY_F16C_ALWAYS)
+  if (isF16cAvailable()) {
+    convertHalfToFloatF16c(src, dst, n);
+    return;
+  }
+#endif  // defined(CLSTUDY_F16C_RUNTIME_DISPATCH) || defined(CLSTUDY_F16C_ALWAYS)
+  for (std::size_t i = 0; i < n; i++) {
+    dst[i] = halfToFloat(src[i]);
+  }
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_HALF_HPP
@@ -0,0 +1,463 @@
+#ifndef CLSTUDY_HOST_COMPUTE_HPP
+#define CLSTUDY_HOST_COMPUTE_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define CLSTUDY_HOST_AVX2
+#  define CLSTUDY_HOST_AVX512
+#  define CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <immintrin.h>
+#  if defined(__AVX2__)
+#    define CLSTUDY_HOST_AVX2
+#  endif  // defined(__AVX2__)
+#  if defined(__AVX512F__)
+#    define CLSTUDY_HOST_AVX512
+#  endif  // defined(__AVX512F__)
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define CLSTUDY_HOST_NEON
+#endif  // defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <clstudy/numa.hpp>
+#include <clstudy/thread_pool.hpp>
+
+
+namespace clstudy
+{
+
+// Instruction set of the host kernels, from the narrowest to the widest.
+enum class HostSimd
+{
+  kScalar,
+  kNeon,
+  kAvx2,
+  kAvx512
+};
+
+
+inline const char*
+getHostSimdName(HostSimd simd) noexcept
+{
+  switch (simd) {
+    case HostSimd::kNeon:
+      return "neon";
+    case HostSimd::kAvx2:
+      return "avx2";
+    case HostSimd::kAvx512:
+      return "avx512";
+    case HostSimd::kScalar:
+    default:
+      return "scalar";
+  }
+}
+
+
+// Whether the host kernel for simd is compiled in and the CPU can run it.
+inline bool
+isHostSimdSupported(HostSimd simd) noexcept
+{
+  switch (simd) {
+    case HostSimd::kScalar:
+      return true;
+#if defined(CLSTUDY_HOST_NEON)
+    case HostSimd::kNeon:
+      return true;
+#endif  // defined(CLSTUDY_HOST_NEON)
+#if defined(CLSTUDY_HOST_AVX2)
+    case HostSimd::kAvx2:
+#  ifdef CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+      return __builtin_cpu_supports("avx2");
+#  else
+      return true;
+#  endif  // CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+#endif  // defined(CLSTUDY_HOST_AVX2)
+#if defined(CLSTUDY_HOST_AVX512)
+    case HostSimd::kAvx512:
+#  ifdef CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+      return __builtin_cpu_supports("avx512f");
+#  else
+      return true;
+#  endif  // CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+#endif  // defined(CLSTUDY_HOST_AVX512)
+#if !defined(CLSTUDY_HOST_NEON)
+    case HostSimd::kNeon:
+#endif  // !defined(CLSTUDY_HOST_NEON)
+#if !defined(CLSTUDY_HOST_AVX2)
+    case HostSimd::kAvx2:
+#endif  // !defined(CLSTUDY_HOST_AVX2)
+#if !defined(CLSTUDY_HOST_AVX512)
+    case HostSimd::kAvx512:
+#endif  // !defined(CLSTUDY_HOST_AVX512)
+    default:
+      return false;
+  }
+}
+
+
+/*!
+ * Widest instruction set the host kernels can use on this CPU.
+ * The environment variable CLSTUDY_HOST_SIMD, one of "scalar", "neon", "avx2"
+ * and "avx512", selects a narrower one, e.g. to see what the vector units
+ * contribute to the host timings.
+ */
+inline HostSimd
+getHostSimdFromEnv()
+{
+  const auto value = std::getenv("CLSTUDY_HOST_SIMD");
+  if (value == nullptr || value[0] == '\0') {
+    for (const auto simd : {HostSimd::kAvx512, HostSimd::kAvx2, HostSimd::kNeon}) {
+      if (isHostSimdSupported(simd)) {
+        return simd;
+      }
+    }
+    return HostSimd::kScalar;
+  }
+
+  const std::string name{value};
+  for (const auto simd : {HostSimd::kScalar, HostSimd::kNeon, HostSimd::kAvx2, HostSimd::kAvx512}) {
+    if (name == getHostSimdName(simd)) {
+      if (!isHostSimdSupported(simd)) {
+        throw std::runtime_error{"CLSTUDY_HOST_SIMD is not supported on this CPU: " + name};
+      }
+      return simd;
+    }
+  }
+  throw std::runtime_error{"Unknown CLSTUDY_HOST_SIMD: " + name};
+}
+
+
+inline void
+multiplyScalar(const float* a, const float* b, float* c, std::size_t n) noexcept
+{
+  for (std::size_t i = 0; i < n; i++) {
+    c[i] = a[i] * b[i];
+  }
+}
+
+
+#if defined(CLSTUDY_HOST_AVX2)
+#  ifdef CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+__attribute__((target("avx2")))
+#  endif  // CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+inline void
+multiplyAvx2(const float* a, const float* b, float* c, std::size_t n) noexcept
+{
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(c + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+  multiplyScalar(a + i, b + i, c + i, n - i);
+}
+#endif  // defined(CLSTUDY_HOST_AVX2)
+
+
+#if defined(CLSTUDY_HOST_AVX512)
+#  ifdef CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+__attribute__((target("avx512f")))
+#  endif  // CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+inline void
+multiplyAvx512(const float* a, const float* b, float* c, std::size_t n) noexcept
+{
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(c + i, _mm512_mul_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+  }
+  if (i < n) {
+    // Masked loads do not touch the lanes past the end.
+    const auto mask = static_cast<__mmask16>((1u << (n - i)) - 1u);
+    const auto x = _mm512_maskz_loadu_ps(mask, a + i);
+    const auto y = _mm512_maskz_loadu_ps(mask, b + i);
+    _mm512_mask_storeu_ps(c + i, mask, _mm512_mul_ps(x, y));
+  }
+}
+#endif  // defined(CLSTUDY_HOST_AVX512)
+
+
+#if defined(CLSTUDY_HOST_NEON)
+inline void
+multiplyNeon(const float* a, const float* b, float* c, std::size_t n) noexcept
+{
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(c + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+  }
+  multiplyScalar(a + i, b + i, c + i, n - i);
+}
+#endif  // defined(CLSTUDY_HOST_NEON)
+
+
+// c[i] = a[i] * b[i] on the calling thread; simd has to be supported.
+inline void
+multiplyHost(HostSimd simd, const float* a, const float* b, float* c, std::size_t n) noexcept
+{
+  switch (simd) {
+#if defined(CLSTUDY_HOST_AVX512)
+    case HostSimd::kAvx512:
+      multiplyAvx512(a, b, c, n);
+      return;
+#endif  // defined(CLSTUDY_HOST_AVX512)
+#if defined(CLSTUDY_HOST_AVX2)
+    case HostSimd::kAvx2:
+      multiplyAvx2(a, b, c, n);
+      return;
+#endif  // defined(CLSTUDY_HOST_AVX2)
+#if defined(CLSTUDY_HOST_NEON)
+    case HostSimd::kNeon:
+      multiplyNeon(a, b, c, n);
+      return;
+#endif  // defined(CLSTUDY_HOST_NEON)
+#if !defined(CLSTUDY_HOST_AVX512)
+    case HostSimd::kAvx512:
+#endif  // !defined(CLSTUDY_HOST_AVX512)
+#if !defined(CLSTUDY_HOST_AVX2)
+    case HostSimd::kAvx2:
+#endif  // !defined(CLSTUDY_HOST_AVX2)
+#if !defined(CLSTUDY_HOST_NEON)
+    case HostSimd::kNeon:
+#endif  // !defined(CLSTUDY_HOST_NEON)
+    case HostSimd::kScalar:
+    default:
+      multiplyScalar(a, b, c, n);
+      return;
+  }
+}
+
+
+/*!
+ * Host counterpart of the device kernels, for reference results and for
+ * timings that can be compared with those of the device: the range is split
+ * into one contiguous chunk per thread, and every chunk is processed with the
+ * widest SIMD kernel the CPU supports.
+ *
+ * On a NUMA system there is one pool per node, whose threads are pinned to
+ * the CPUs of that node. parallelFor() gives every node a fixed share of the
+ * range, so pages first touched by generate() are local to the threads that
+ * process them later with the same n. generateOnNode() touches all pages on
+ * one node instead, e.g. that of the device which reads the buffer.
+ *
+ * Chunks start on multiples of kGrainSize elements, so that with buffers of
+ * AlignedAllocator the threads neither share cache lines nor start on
+ * unaligned addresses. Create an instance once, outside of a measured
+ * section, since the constructor starts the threads.
+ */
+class HostCompute
+{
+public:
+  // Elements of a cache line of float
+  static constexpr std::size_t kGrainSize = 16;
+  // Below this, waking up the threads costs more than it saves.
+  static constexpr std::size_t kMinParallelSize = 1 << 16;
+
+  explicit HostCompute(std::size_t nThreads = std::thread::hardware_concurrency())
+    : m_pools()
+    , m_nThreads(0)
+    , m_simd(getHostSimdFromEnv())
+  {
+    if (nThreads == 0) {
+      nThreads = 1;
+    }
+    const auto nodes = getNumaNodes();
+    if (nodes.size() == 1 || nThreads < nodes.size()) {
+      m_pools.push_back(NodePool{nodes.size() == 1 ? nodes[0].id : -1, std::make_unique<ThreadPool>(nThreads)});
+      m_nThreads = nThreads;
+      return;
+    }
+
+    std::size_t nCpus = 0;
+    for (const auto& node : nodes) {
+      nCpus += node.cpus.size();
+    }
+    for (const auto& node : nodes) {
+      const auto nNodeThreads = std::max<std::size_t>(1, nThreads * node.cpus.size() / nCpus);
+      const auto cpus = node.cpus;
+      m_pools.push_back(NodePool{node.id, std::make_unique<ThreadPool>(nNodeThreads, [cpus] {
+        pinCurrentThread(cpus);
+      })});
+      m_nThreads += nNodeThreads;
+    }
+  }
+
+  HostSimd
+  simd() const noexcept
+  {
+    return m_simd;
+  }
+
+  std::size_t
+  nThreads() const noexcept
+  {
+    return m_nThreads;
+  }
+
+  // Number of pools with pinned threads; 1 without NUMA.
+  std::size_t
+  nNodes() const noexcept
+  {
+    return m_pools.size();
+  }
+
+  // e.g. "avx2 x 8 threads", for the output of the samples
+  std::string
+  describe() const
+  {
+    auto description = std::string{getHostSimdName(m_simd)} + " x " + std::to_string(nThreads()) + " threads";
+    if (nNodes() > 1) {
+      description += " on " + std::to_string(nNodes()) + " NUMA nodes";
+    }
+    return description;
+  }
+
+  /*!
+   * Call f(begin, end) for disjoint ranges covering [0, n) on the threads of
+   * the pools and wait for all of them. Every node gets a share of the range
+   * proportional to its threads. Rethrows the first exception thrown by f,
+   * after every call has finished.
+   */
+  template<typename F>
+  void
+  parallelFor(std::size_t n, F f)
+  {
+    if (n < kMinParallelSize || nThreads() == 1) {
+      f(std::size_t{0}, n);
+      return;
+    }
+
+    std::vector<std::future<void>> futures;
+    std::size_t begin = 0;
+    std::size_t nThreadsBefore = 0;
+    for (auto& nodePool : m_pools) {
+      nThreadsBefore += nodePool.pool->size();
+      const auto end = nThreadsBefore == nThreads() ? n : std::min(n, roundUpToGrain(n * nThreadsBefore / nThreads()));
+      submitChunks(*nodePool.pool, begin, end, f, futures);
+      begin = end;
+    }
+    waitAll(futures);
+  }
+
+  /*!
+   * parallelFor() on the threads of NUMA node node only. Uses all nodes if
+   * node is not one of them, e.g. -1 from getDeviceNumaNode().
+   */
+  template<typename F>
+  void
+  parallelForOnNode(int node, std::size_t n, F f)
+  {
+    const auto itr = std::find_if(std::begin(m_pools), std::end(m_pools), [node](const auto& nodePool) {
+      return nodePool.node == node;
+    });
+    if (nNodes() == 1 || itr == std::end(m_pools)) {
+      parallelFor(n, f);
+      return;
+    }
+    std::vector<std::future<void>> futures;
+    submitChunks(*itr->pool, 0, n, f, futures);
+    waitAll(futures);
+  }
+
+  /*!
+   * data[i] = f(i) for [0, n) with parallelFor(), so that the pages of a
+   * buffer without value-initialization, see UninitializedAllocator, are
+   * first touched where parallelFor() processes them.
+   */
+  template<
+    typename T,
+    typename F
+  >
+  void
+  generate(T* data, std::size_t n, F f)
+  {
+    parallelFor(n, [data, f](std::size_t begin, std::size_t end) {
+      for (auto i = begin; i < end; i++) {
+        data[i] = f(i);
+      }
+    });
+  }
+
+  // generate() with the threads of NUMA node node, see parallelForOnNode().
+  template<
+    typename T,
+    typename F
+  >
+  void
+  generateOnNode(int node, T* data, std::size_t n, F f)
+  {
+    parallelForOnNode(node, n, [data, f](std::size_t begin, std::size_t end) {
+      for (auto i = begin; i < end; i++) {
+        data[i] = f(i);
+      }
+    });
+  }
+
+  // c[i] = a[i] * b[i]
+  void
+  multiply(const float* a, const float* b, float* c, std::size_t n)
+  {
+    const auto simd = m_simd;
+    parallelFor(n, [=](std::size_t begin, std::size_t end) {
+      multiplyHost(simd, a + begin, b + begin, c + begin, end - begin);
+    });
+  }
+
+private:
+  struct NodePool
+  {
+    // NUMA node of the threads, or -1 if they are not pinned
+    int node;
+    std::unique_ptr<ThreadPool> pool;
+  };
+
+  static std::size_t
+  roundUpToGrain(std::size_t x) noexcept
+  {
+    return (x + kGrainSize - 1) / kGrainSize * kGrainSize;
+  }
+
+  // Split [begin, end) into one chunk per thread of pool.
+  template<typename F>
+  static void
+  submitChunks(ThreadPool& pool, std::size_t begin, std::size_t end, F& f, std::vector<std::future<void>>& futures)
+  {
+    if (begin >= end) {
+      return;
+    }
+    const auto chunkSize = roundUpToGrain((end - begin + pool.size() - 1) / pool.size());
+    for (auto chunkBegin = begin; chunkBegin < end; chunkBegin += chunkSize) {
+      const auto chunkEnd = std::min(end, chunkBegin + chunkSize);
+      futures.push_back(pool.submit([&f, chunkBegin, chunkEnd] {
+        f(chunkBegin, chunkEnd);
+      }));
+    }
+  }
+
+  // f is referenced by the tasks until every one of them has finished.
+  static void
+  waitAll(std::vector<std::future<void>>& futures)
+  {
+    for (auto& future : futures) {
+      future.wait();
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+  }
+
+  std::vector<NodePool> m_pools;
+  std::size_t m_nThreads;
+  HostSimd m_simd;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_HOST_COMPUTE_HPP
@@ -0,0 +1,157 @@
+#ifndef CLSTUDY_KERNEL_SOURCE_HPP
+#define CLSTUDY_KERNEL_SOURCE_HPP
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace clstudy
+{
+
+inline std::size_t
+getStreamSize(std::istream& is) noexcept
+{
+  const auto currentPos = is.tellg();
+  is.seekg(0, std::ifstream::end);
+  const auto endPos = is.tellg();
+  is.seekg(currentPos, std::ifstream::beg);
+  return static_cast<std::size_t>(endPos - currentPos);
+}
+
+
+inline std::string
+readTextAll(std::ifstream& ifs) noexcept
+{
+  std::string text;
+  text.resize(getStreamSize(ifs));
+  ifs.read(&text[0], static_cast<std::streamsize>(text.size()));
+  return text;
+}
+
+
+// Kernel sources embedded by generate_embedded_kernel_header(), and their
+// SPIR-V embedded by compile_opencl_to_spirv(), keyed by the file name without
+// extension.
+class KernelSourceRegistry
+{
+public:
+  static KernelSourceRegistry&
+  getInstance()
+  {
+    static KernelSourceRegistry instance;
+    return instance;
+  }
+
+  void
+  add(const std::string& name, const char* data, std::size_t size)
+  {
+    m_sources[name] = std::make_pair(data, size);
+  }
+
+  bool
+  find(const std::string& name, std::string& source) const
+  {
+    const auto it = m_sources.find(name);
+    if (it == m_sources.end()) {
+      return false;
+    }
+    source.assign(it->second.first, it->second.second);
+    return true;
+  }
+
+  void
+  addIL(const std::string& name, const char* data, std::size_t size)
+  {
+    m_ils[name] = std::make_pair(data, size);
+  }
+
+  bool
+  findIL(const std::string& name, std::vector<char>& il) const
+  {
+    const auto it = m_ils.find(name);
+    if (it == m_ils.end()) {
+      return false;
+    }
+    il.assign(it->second.first, it->second.first + it->second.second);
+    return true;
+  }
+
+private:
+  KernelSourceRegistry()
+    : m_sources()
+    , m_ils()
+  {}
+
+  std::map<std::string, std::pair<const char*, std::size_t>> m_sources;
+  std::map<std::string, std::pair<const char*, std::size_t>> m_ils;
+};
+
+
+class KernelSourceRegistrar
+{
+public:
+  KernelSourceRegistrar(const char* name, const char* data, std::size_t size)
+  {
+    KernelSourceRegistry::getInstance().add(name, data, size);
+  }
+};
+
+
+class KernelILRegistrar
+{
+public:
+  KernelILRegistrar(const char* name, const char* data, std::size_t size)
+  {
+    KernelSourceRegistry::getInstance().addIL(name, data, size);
+  }
+};
+
+
+inline bool
+readKernelSourceFile(const std::string& filePath, std::string& source)
+{
+  std::ifstream ifs{filePath};
+  if (!ifs.is_open()) {
+    return false;
+  }
+  source = readTextAll(ifs);
+  return true;
+}
+
+
+/*!
+ * Resolve the OpenCL C source named baseName.
+ *
+ * When the environment variable CLSTUDY_KERNEL_DIR is set,
+ * "$CLSTUDY_KERNEL_DIR/<baseName>.cl" takes precedence, so that kernels can be
+ * edited without rebuilding the executable. Otherwise the embedded source is
+ * used without touching the filesystem. "<baseName>.cl" in the working
+ * directory is the last resort for targets that embed nothing.
+ */
+inline std::string
+loadKernelSource(const std::string& baseName)
+{
+  std::string source;
+  const auto kernelDir = std::getenv("CLSTUDY_KERNEL_DIR");
+  if (kernelDir != nullptr && kernelDir[0] != '\0'
+      && readKernelSourceFile(std::string{kernelDir} + "/" + baseName + ".cl", source)) {
+    return source;
+  }
+  if (KernelSourceRegistry::getInstance().find(baseName, source)) {
+    return source;
+  }
+  if (readKernelSourceFile(baseName + ".cl", source)) {
+    return source;
+  }
+  throw std::runtime_error{"Kernel source not found: " + baseName};
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_KERNEL_SOURCE_HPP
@@ -0,0 +1,275 @@
+#ifndef CLSTUDY_KERNEL_VARIANT_HPP
+#define CLSTUDY_KERNEL_VARIANT_HPP
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/half.hpp>
+#include <clstudy/program_cache.hpp>
+
+
+namespace clstudy
+{
+
+// Tag for the OpenCL C "half" type, whose host representation is a bare cl_half
+// and which the host computes with as float.
+struct Half
+{};
+
+
+/*!
+ * Describes how an element type is spelled in OpenCL C and which extension the
+ * device has to support for it. Elements are stored as StorageType and
+ * converted with toHost() / toStorage() to HostType for host arithmetic.
+ */
+template<typename T>
+struct KernelTypeTraits;
+
+template<>
+struct KernelTypeTraits<float>
+{
+  using StorageType = cl_float;
+  using HostType = StorageType;
+  static constexpr const char* kName = "float";
+  static constexpr const char* kExtension = "";
+  static constexpr const char* kDefine = "";
+
+  static HostType
+  toHost(StorageType value) noexcept
+  {
+    return value;
+  }
+
+  static StorageType
+  toStorage(HostType value) noexcept
+  {
+    return value;
+  }
+};
+
+template<>
+struct KernelTypeTraits<double>
+{
+  using StorageType = cl_double;
+  using HostType = StorageType;
+  static constexpr const char* kName = "double";
+  static constexpr const char* kExtension = "cl_khr_fp64";
+  static constexpr const char* kDefine = "ENABLE_FP64";
+
+  static HostType
+  toHost(StorageType value) noexcept
+  {
+    return value;
+  }
+
+  static StorageType
+  toStorage(HostType value) noexcept
+  {
+    return value;
+  }
+};
+
+template<>
+struct KernelTypeTraits<Half>
+{
+  using StorageType = cl_half;
+  using HostType = float;
+  static constexpr const char* kName = "half";
+  static constexpr const char* kExtension = "cl_khr_fp16";
+  static constexpr const char* kDefine = "ENABLE_FP16";
+
+  static HostType
+  toHost(StorageType value) noexcept
+  {
+    return halfToFloat(value);
+  }
+
+  static StorageType
+  toStorage(HostType value) noexcept
+  {
+    return floatToHalf(value);
+  }
+};
+
+template<>
+struct KernelTypeTraits<int>
+{
+  using StorageType = cl_int;
+  using HostType = StorageType;
+  static constexpr const char* kName = "int";
+  static constexpr const char* kExtension = "";
+  static constexpr const char* kDefine = "";
+
+  static HostType
+  toHost(StorageType value) noexcept
+  {
+    return value;
+  }
+
+  static StorageType
+  toStorage(HostType value) noexcept
+  {
+    return value;
+  }
+};
+
+
+template<std::size_t N>
+struct Unroll
+{
+  static_assert(N > 0, "[Unroll] Unroll factor must be positive.");
+  static constexpr std::size_t value = N;
+};
+
+
+/*!
+ * Compile-time description of a specialization of a kernel source.
+ *
+ * A variant is turned into the build options
+ *   -D ELEM_TYPE=<T> -D VECTOR_WIDTH=<kVectorWidth> -D UNROLL=<TUnroll::value>
+ * (plus ENABLE_FP64 / ENABLE_FP16 for double and half), so one kernel file
+ * can be specialized without duplicating it. The kernel file is expected to
+ * provide defaults for these macros.
+ */
+template<
+  typename T,
+  std::size_t kVectorWidth = 1,
+  typename TUnroll = Unroll<1>
+>
+struct KernelVariant
+{
+  static_assert(
+    kVectorWidth == 1 || kVectorWidth == 2 || kVectorWidth == 4 || kVectorWidth == 8 || kVectorWidth == 16,
+    "[KernelVariant] Vector width must be one of 1, 2, 4, 8 and 16.");
+
+  using ElementType = T;
+  using StorageType = typename KernelTypeTraits<T>::StorageType;
+  using HostType = typename KernelTypeTraits<T>::HostType;
+
+  static constexpr std::size_t kWidth = kVectorWidth;
+  static constexpr std::size_t kUnroll = TUnroll::value;
+  // Number of elements one work-item processes.
+  static constexpr std::size_t kElementsPerWorkItem = kVectorWidth * TUnroll::value;
+
+  static std::string
+  buildOptions()
+  {
+    std::string options = std::string{"-D ELEM_TYPE="} + KernelTypeTraits<T>::kName
+      + " -D VECTOR_WIDTH=" + std::to_string(kVectorWidth)
+      + " -D UNROLL=" + std::to_string(TUnroll::value);
+    if (KernelTypeTraits<T>::kDefine[0] != '\0') {
+      options += std::string{" -D "} + KernelTypeTraits<T>::kDefine;
+    }
+    return options;
+  }
+
+  // Human readable key, e.g. "float4_unroll8".
+  static std::string
+  key()
+  {
+    return std::string{KernelTypeTraits<T>::kName}
+      + (kVectorWidth == 1 ? "" : std::to_string(kVectorWidth))
+      + "_unroll" + std::to_string(TUnroll::value);
+  }
+
+  static bool
+  isSupported(const cl::Device& device)
+  {
+    const std::string extension{KernelTypeTraits<T>::kExtension};
+    return extension.empty() || hasExtension(device, extension);
+  }
+
+  static bool
+  isSupported(const std::vector<cl::Device>& devices)
+  {
+    for (const auto& device : devices) {
+      if (!isSupported(device)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+
+/*!
+ * Lazily builds the variants of one kernel file and memoizes them per context.
+ *
+ * A variant is compiled by buildProgramFromFile() on its first request, so
+ * its binary is also kept in the on-disk program cache; the build options
+ * are part of the cache key, so variants never collide there.
+ */
+class KernelVariantCache
+{
+public:
+  explicit KernelVariantCache(std::string baseName)
+    : m_baseName(std::move(baseName))
+    , m_programs()
+    , m_mutex()
+  {}
+
+  KernelVariantCache(const KernelVariantCache&) = delete;
+
+  KernelVariantCache&
+  operator=(const KernelVariantCache&) = delete;
+
+  template<typename TVariant>
+  cl::Program
+  getProgram(const cl::Context& context, const std::vector<cl::Device>& devices)
+  {
+    // The memoized program holds a reference to its context, so the handle
+    // stays valid as a key for the lifetime of the entry.
+    const auto key = std::make_pair(context(), TVariant::buildOptions());
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const auto it = m_programs.find(key);
+    if (it != m_programs.end()) {
+      return it->second;
+    }
+    auto program = buildProgramFromFile(m_baseName, context, devices, key.second);
+    m_programs.emplace(key, program);
+    return program;
+  }
+
+  template<
+    typename TVariant,
+    typename... Ts
+  >
+  cl::KernelFunctor<Ts...>
+  getKernelFunctor(
+    const cl::Context& context,
+    const std::vector<cl::Device>& devices,
+    const std::string& kernelName)
+  {
+    return cl::KernelFunctor<Ts...>{getProgram<TVariant>(context, devices), kernelName};
+  }
+
+  std::size_t
+  size()
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_programs.size();
+  }
+
+  void
+  clear()
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_programs.clear();
+  }
+
+private:
+  std::string m_baseName;
+  std::map<std::pair<cl_context, std::string>, cl::Program> m_programs;
+  std::mutex m_mutex;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_KERNEL_VARIANT_HPP
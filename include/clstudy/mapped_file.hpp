@@ -0,0 +1,162 @@
+#ifndef CLSTUDY_MAPPED_FILE_HPP
+#define CLSTUDY_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif  // _WIN32
+
+
+namespace clstudy
+{
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+  MappedFile() noexcept
+    : m_data(nullptr)
+    , m_size(0)
+  {}
+
+  explicit MappedFile(const std::string& filePath) noexcept
+    : MappedFile()
+  {
+    open(filePath);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+
+  MappedFile&
+  operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept
+    : m_data(other.m_data)
+    , m_size(other.m_size)
+  {
+    other.m_data = nullptr;
+    other.m_size = 0;
+  }
+
+  MappedFile&
+  operator=(MappedFile&& other) noexcept
+  {
+    if (this != &other) {
+      close();
+      std::swap(m_data, other.m_data);
+      std::swap(m_size, other.m_size);
+    }
+    return *this;
+  }
+
+  ~MappedFile()
+  {
+    close();
+  }
+
+  bool
+  open(const std::string& filePath) noexcept
+  {
+    close();
+#ifdef _WIN32
+    const auto hFile = ::CreateFileA(
+      filePath.c_str(),
+      GENERIC_READ,
+      FILE_SHARE_READ | FILE_SHARE_DELETE,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!::GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+      ::CloseHandle(hFile);
+      return false;
+    }
+    const auto hMapping = ::CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    ::CloseHandle(hFile);
+    if (hMapping == nullptr) {
+      return false;
+    }
+    // The view keeps the mapping object alive.
+    const auto addr = ::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    ::CloseHandle(hMapping);
+    if (addr == nullptr) {
+      return false;
+    }
+    m_data = static_cast<unsigned char*>(addr);
+    m_size = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+    const auto fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd == -1) {
+      return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || st.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+    const auto size = static_cast<std::size_t>(st.st_size);
+    const auto addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    m_data = static_cast<unsigned char*>(addr);
+    m_size = size;
+#endif  // _WIN32
+    return true;
+  }
+
+  void
+  close() noexcept
+  {
+    if (m_data == nullptr) {
+      return;
+    }
+#ifdef _WIN32
+    ::UnmapViewOfFile(m_data);
+#else
+    ::munmap(m_data, m_size);
+#endif  // _WIN32
+    m_data = nullptr;
+    m_size = 0;
+  }
+
+  bool
+  isOpen() const noexcept
+  {
+    return m_data != nullptr;
+  }
+
+  const unsigned char*
+  data() const noexcept
+  {
+    return m_data;
+  }
+
+  std::size_t
+  size() const noexcept
+  {
+    return m_size;
+  }
+
+private:
+  unsigned char* m_data;
+  std::size_t m_size;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_MAPPED_FILE_HPP
@@ -0,0 +1,147 @@
+#ifndef CLSTUDY_NUMA_HPP
+#define CLSTUDY_NUMA_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#  include <pthread.h>
+#  include <sched.h>
+#endif  // defined(__linux__)
+
+#include <config/opencl.hpp>
+#include <clstudy/device.hpp>
+
+
+namespace clstudy
+{
+
+struct NumaNode
+{
+  // Node number of the operating system
+  int id;
+  // CPUs of the node; empty if unknown, i.e. any CPU
+  std::vector<int> cpus;
+};
+
+
+// Parse a CPU or node list of sysfs, e.g. "0-3,8,10-11".
+inline std::vector<int>
+parseCpuList(const std::string& list)
+{
+  std::vector<int> cpus;
+  std::istringstream iss{list};
+  std::string range;
+  while (std::getline(iss, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    const auto pos = range.find('-');
+    const auto first = std::stoi(range.substr(0, pos));
+    const auto last = pos == std::string::npos ? first : std::stoi(range.substr(pos + 1));
+    for (auto cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+
+/*!
+ * NUMA nodes with CPUs, read from /sys/devices/system/node on Linux.
+ * Elsewhere, or if that fails, a single node 0 without a CPU list.
+ */
+inline std::vector<NumaNode>
+getNumaNodes()
+{
+  std::vector<NumaNode> nodes;
+#if defined(__linux__)
+  std::ifstream online{"/sys/devices/system/node/online"};
+  std::string nodeList;
+  if (std::getline(online, nodeList)) {
+    for (const auto id : parseCpuList(nodeList)) {
+      std::ifstream ifs{"/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"};
+      std::string cpuList;
+      if (std::getline(ifs, cpuList)) {
+        auto cpus = parseCpuList(cpuList);
+        // Memory-only nodes have no threads to touch their pages.
+        if (!cpus.empty()) {
+          nodes.push_back(NumaNode{id, std::move(cpus)});
+        }
+      }
+    }
+  }
+#endif  // defined(__linux__)
+  if (nodes.empty()) {
+    nodes.push_back(NumaNode{0, {}});
+  }
+  return nodes;
+}
+
+
+// Restrict the calling thread to cpus; false if that is not possible.
+inline bool
+pinCurrentThread(const std::vector<int>& cpus) noexcept
+{
+#if defined(__linux__)
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (const auto cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(static_cast<std::size_t>(cpu), &cpuSet);
+    }
+  }
+  return ::pthread_setaffinity_np(::pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+  static_cast<void>(cpus);
+  return false;
+#endif  // defined(__linux__)
+}
+
+
+/*!
+ * NUMA node the PCI device is attached to, for buffers it reads from host
+ * memory, e.g. those of CL_MEM_USE_HOST_PTR. Needs cl_khr_pci_bus_info and
+ * Linux; returns -1 if the node is unknown or the device is not on PCI.
+ */
+inline int
+getDeviceNumaNode(const cl::Device& device)
+{
+#if defined(__linux__) && defined(CL_DEVICE_PCI_BUS_INFO_KHR)
+  if (!hasExtension(device, "cl_khr_pci_bus_info")) {
+    return -1;
+  }
+  cl_device_pci_bus_info_khr info;
+  if (::clGetDeviceInfo(device(), CL_DEVICE_PCI_BUS_INFO_KHR, sizeof(info), &info, nullptr) != CL_SUCCESS) {
+    return -1;
+  }
+  char path[64];
+  std::snprintf(
+    path,
+    sizeof(path),
+    "/sys/bus/pci/devices/%04x:%02x:%02x.%x/numa_node",
+    info.pci_domain,
+    info.pci_bus,
+    info.pci_device,
+    info.pci_function);
+  std::ifstream ifs{path};
+  int node = -1;
+  return ifs >> node ? node : -1;
+#else
+  static_cast<void>(device);
+  return -1;
+#endif  // defined(__linux__) && defined(CL_DEVICE_PCI_BUS_INFO_KHR)
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_NUMA_HPP
@@ -0,0 +1,286 @@
+#ifndef CLSTUDY_PIPELINE_HPP
+#define CLSTUDY_PIPELINE_HPP
+
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/device.hpp>
+#include <clstudy/kernel_source.hpp>
+#include <clstudy/program_cache.hpp>
+
+
+namespace clstudy
+{
+
+/*!
+ * Macros prepended to the kernel source of a KernelPipeline, so that one
+ * source serves both ways of connecting the stages:
+ *   STAGE_INPUT(T), STAGE_OUTPUT(T)  parameters for the incoming and outgoing
+ *                                    packets of type T
+ *   STAGE_READ(p), STAGE_WRITE(p)    move one packet, true on success
+ * With buffers, work-item i of a batch reads and writes packet i.
+ */
+inline std::string
+getPipelinePrelude(bool isPipeUsed)
+{
+  const std::string prelude = isPipeUsed
+    ? "#define STAGE_INPUT(T) read_only pipe T stageInput\n"
+      "#define STAGE_OUTPUT(T) write_only pipe T stageOutput\n"
+      "#define STAGE_READ(p) (read_pipe(stageInput, (p)) == 0)\n"
+      "#define STAGE_WRITE(p) (write_pipe(stageOutput, (p)) == 0)\n"
+    : "#define STAGE_INPUT(T) __global const T *stageInput\n"
+      "#define STAGE_OUTPUT(T) __global T *stageOutput\n"
+      "#define STAGE_READ(p) (*(p) = stageInput[get_global_id(0) - get_global_offset(0)], true)\n"
+      "#define STAGE_WRITE(p) (stageOutput[get_global_id(0) - get_global_offset(0)] = *(p), true)\n";
+  // Keep the line numbers of build logs those of the kernel file.
+  return prelude + "#line 1\n";
+}
+
+
+struct PipelineStageStats
+{
+  std::string kernelName;
+  // Sum of the execution times of the stage over all batches
+  double busySeconds;
+  std::size_t nPackets;
+
+  double
+  packetsPerSecond() const noexcept
+  {
+    return static_cast<double>(nPackets) / busySeconds;
+  }
+};
+
+
+struct PipelineReport
+{
+  double seconds;
+  std::vector<PipelineStageStats> stages;
+};
+
+
+/*!
+ * Chain of kernels, a producer, any number of filters and a consumer, which
+ * stream packets of a fixed size from one stage to the next.
+ *
+ * On devices with pipes, the stages are connected by cl::Pipe objects and run
+ * on their own command queues, so that consecutive batches of different stages
+ * overlap and intermediate packets never go through a buffer the host sees.
+ * Otherwise each connection is a pair of buffers of one batch, used
+ * alternately.
+ *
+ * A stage kernel takes STAGE_INPUT(T) unless it is the producer, then
+ * STAGE_OUTPUT(T) unless it is the consumer, then the arguments given to
+ * addStage(). Every stage is launched with one work-item per packet, with the
+ * index of the packet as global ID, and every work-item has to read and write
+ * exactly one packet.
+ *
+ * Batch b of a stage waits for batch b of the previous stage, and for batch
+ * b - 2 of the next stage, which bounds the packets in a connection to two
+ * batches.
+ */
+class KernelPipeline
+{
+public:
+  KernelPipeline(
+    cl::Context context,
+    cl::Device device,
+    const std::string& baseName,
+    std::size_t packetSize,
+    std::size_t batchSize,
+    const std::string& options = "",
+    bool isPipeAllowed = true)
+    : m_context(std::move(context))
+    , m_device(std::move(device))
+    , m_packetSize(packetSize)
+    , m_batchSize(batchSize)
+    , m_isPipeUsed(isPipeAllowed && canUsePipes(m_device, packetSize))
+    , m_program(buildCachedProgram(
+        baseName,
+        ProgramSource{getPipelinePrelude(m_isPipeUsed) + loadKernelSource(baseName), {}},
+        m_context,
+        {m_device},
+        (m_isPipeUsed ? "-cl-std=CL2.0 -D USE_PIPES " : "") + options))
+    , m_stages()
+  {}
+
+  KernelPipeline(const KernelPipeline&) = delete;
+
+  KernelPipeline&
+  operator=(const KernelPipeline&) = delete;
+
+  bool
+  isPipeUsed() const noexcept
+  {
+    return m_isPipeUsed;
+  }
+
+  // Append a stage; args follow the stage input and output of the kernel.
+  template<typename... Ts>
+  KernelPipeline&
+  addStage(const std::string& kernelName, Ts... args)
+  {
+    m_stages.push_back(Stage{
+      kernelName,
+      cl::Kernel{m_program, kernelName.c_str()},
+      [args...](cl::Kernel& kernel, cl_uint index) {
+        setArgs(kernel, index, args...);
+      }});
+    return *this;
+  }
+
+  // Stream n packets through the stages and wait for them.
+  PipelineReport
+  run(std::size_t n)
+  {
+    if (m_stages.size() < 2) {
+      throw std::logic_error{"[KernelPipeline] A pipeline needs a producer and a consumer."};
+    }
+    const auto nStages = m_stages.size();
+    const auto nBatches = (n + m_batchSize - 1) / m_batchSize;
+
+    std::vector<cl::CommandQueue> queues;
+    for (std::size_t s = 0; s < nStages; s++) {
+      queues.emplace_back(m_context, m_device, CL_QUEUE_PROFILING_ENABLE);
+    }
+
+    std::vector<cl::Pipe> pipes;
+    std::vector<std::array<cl::Buffer, 2>> buffers;
+    for (std::size_t s = 0; s + 1 < nStages; s++) {
+      if (m_isPipeUsed) {
+        pipes.emplace_back(
+          m_context,
+          static_cast<cl_uint>(m_packetSize),
+          static_cast<cl_uint>(m_batchSize * 2));
+      } else {
+        buffers.push_back({
+          cl::Buffer{m_context, CL_MEM_READ_WRITE, m_packetSize * m_batchSize},
+          cl::Buffer{m_context, CL_MEM_READ_WRITE, m_packetSize * m_batchSize}});
+      }
+    }
+    if (m_isPipeUsed) {
+      for (std::size_t s = 0; s < nStages; s++) {
+        setStageArgs(s, pipes);
+      }
+    }
+
+    std::vector<std::vector<cl::Event>> events(nStages, std::vector<cl::Event>(nBatches));
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (std::size_t b = 0; b < nBatches; b++) {
+      const auto offset = b * m_batchSize;
+      const auto size = std::min(m_batchSize, n - offset);
+      for (std::size_t s = 0; s < nStages; s++) {
+        if (!m_isPipeUsed) {
+          std::vector<cl::Buffer> connections;
+          for (const auto& pair : buffers) {
+            connections.push_back(pair[b % 2]);
+          }
+          setStageArgs(s, connections);
+        }
+
+        std::vector<cl::Event> waitList;
+        if (s > 0) {
+          waitList.push_back(events[s - 1][b]);
+        }
+        if (s + 1 < nStages && b >= 2) {
+          waitList.push_back(events[s + 1][b - 2]);
+        }
+        queues[s].enqueueNDRangeKernel(
+          m_stages[s].kernel,
+          cl::NDRange{offset},
+          cl::NDRange{size},
+          cl::NullRange,
+          &waitList,
+          &events[s][b]);
+        // Other queues can only wait for events of flushed commands.
+        queues[s].flush();
+      }
+    }
+    for (auto& queue : queues) {
+      queue.finish();
+    }
+
+    PipelineReport report{
+      std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count(),
+      {}};
+    for (std::size_t s = 0; s < nStages; s++) {
+      cl_ulong busyNanoseconds = 0;
+      for (const auto& event : events[s]) {
+        busyNanoseconds += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+      }
+      report.stages.push_back(PipelineStageStats{
+        m_stages[s].kernelName,
+        static_cast<double>(busyNanoseconds) * 1.0e-9,
+        n});
+    }
+    return report;
+  }
+
+private:
+  struct Stage
+  {
+    std::string kernelName;
+    cl::Kernel kernel;
+    // Sets the arguments of addStage() from the given index on
+    std::function<void(cl::Kernel&, cl_uint)> setUserArgs;
+  };
+
+  static bool
+  canUsePipes(const cl::Device& device, std::size_t packetSize)
+  {
+#if CL_HPP_TARGET_OPENCL_VERSION >= 200
+    return isPipeSupported(device)
+      && packetSize <= device.getInfo<CL_DEVICE_PIPE_MAX_PACKET_SIZE>();
+#else
+    static_cast<void>(device);
+    static_cast<void>(packetSize);
+    return false;
+#endif  // CL_HPP_TARGET_OPENCL_VERSION >= 200
+  }
+
+  template<typename... Ts>
+  static void
+  setArgs(cl::Kernel& kernel, cl_uint index, const Ts&... args)
+  {
+    static_cast<void>(std::initializer_list<int>{(kernel.setArg(index++, args), 0)...});
+    static_cast<void>(index);
+  }
+
+  // connections[s] joins stage s and stage s + 1.
+  template<typename TMemory>
+  void
+  setStageArgs(std::size_t s, const std::vector<TMemory>& connections)
+  {
+    auto& stage = m_stages[s];
+    cl_uint index = 0;
+    if (s > 0) {
+      stage.kernel.setArg(index++, connections[s - 1]);
+    }
+    if (s + 1 < m_stages.size()) {
+      stage.kernel.setArg(index++, connections[s]);
+    }
+    stage.setUserArgs(stage.kernel, index);
+  }
+
+  cl::Context m_context;
+  cl::Device m_device;
+  std::size_t m_packetSize;
+  std::size_t m_batchSize;
+  bool m_isPipeUsed;
+  cl::Program m_program;
+  std::vector<Stage> m_stages;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_PIPELINE_HPP
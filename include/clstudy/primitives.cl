@@ -0,0 +1,234 @@
+// Kernels of clstudy::ParallelPrimitives.
+// Built with -D USE_SUB_GROUPS (and -cl-std=CL2.0) when every device supports
+// cl_khr_subgroups; the work-group scan then works on sub-groups instead of a
+// tree in local memory.
+
+#ifdef USE_SUB_GROUPS
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif  // USE_SUB_GROUPS
+
+#define RADIX_BITS 4
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+
+#ifdef USE_SUB_GROUPS
+// Position of the work-item in the order of groupScanExclusive(). Work-items
+// are mapped to sub-groups in an implementation-defined way, so the scan goes
+// by sub-group and then by the index in the sub-group, not by
+// get_local_id(0). All sub-groups but the last have the maximum size, so the
+// ranks are 0, ..., get_local_size(0) - 1.
+uint
+groupRank(void)
+{
+  return get_sub_group_id() * get_max_sub_group_size() + get_sub_group_local_id();
+}
+
+
+// Exclusive prefix sum of x over the work-group, in the order of groupRank().
+// *total receives the sum over the whole work-group. scratch holds
+// get_num_sub_groups() + 1 uints.
+uint
+groupScanExclusive(uint x, __local uint *scratch, uint *total)
+{
+  const uint prefix = sub_group_scan_exclusive_add(x);
+  if (get_sub_group_local_id() == get_sub_group_size() - 1) {
+    scratch[get_sub_group_id()] = prefix + x;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // The first sub-group scans the sub-group totals, a sub-group at a time.
+  if (get_sub_group_id() == 0) {
+    const uint nSubGroups = get_num_sub_groups();
+    uint carry = 0;
+    for (uint base = 0; base < nSubGroups; base += get_sub_group_size()) {
+      const uint i = base + get_sub_group_local_id();
+      const uint value = i < nSubGroups ? scratch[i] : 0;
+      const uint offset = sub_group_scan_exclusive_add(value);
+      if (i < nSubGroups) {
+        scratch[i] = carry + offset;
+      }
+      carry += sub_group_reduce_add(value);
+    }
+    if (get_sub_group_local_id() == 0) {
+      scratch[nSubGroups] = carry;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  *total = scratch[get_num_sub_groups()];
+  return prefix + scratch[get_sub_group_id()];
+}
+#else
+uint
+groupRank(void)
+{
+  return get_local_id(0);
+}
+
+
+// Exclusive prefix sum of x over the work-group by the work-efficient
+// up-sweep / down-sweep of Blelloch. *total receives the sum over the whole
+// work-group. The local size must be a power of two and scratch holds
+// get_local_size(0) + 1 uints.
+uint
+groupScanExclusive(uint x, __local uint *scratch, uint *total)
+{
+  const uint lid = get_local_id(0);
+  const uint n = get_local_size(0);
+
+  scratch[lid] = x;
+  for (uint offset = 1; offset < n; offset <<= 1) {
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const uint i = (lid + 1) * (offset << 1) - 1;
+    if (i < n) {
+      scratch[i] += scratch[i - offset];
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (lid == 0) {
+    scratch[n] = scratch[n - 1];
+    scratch[n - 1] = 0;
+  }
+  for (uint offset = n >> 1; offset > 0; offset >>= 1) {
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const uint i = (lid + 1) * (offset << 1) - 1;
+    if (i < n) {
+      const uint t = scratch[i - offset];
+      scratch[i - offset] = scratch[i];
+      scratch[i] += t;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  *total = scratch[n];
+  return scratch[lid];
+}
+#endif  // USE_SUB_GROUPS
+
+
+// Scans blocks of 2 * get_local_size(0) elements independently and writes the
+// sum of each block to blockSums. output may be input. Each work-item takes the
+// two elements at its groupRank() in the block.
+__kernel void
+scanBlocks(
+    __global uint *output,
+    __global const uint *input,
+    __global uint *blockSums,
+    __local uint *scratch,
+    uint n,
+    uint isInclusive)
+{
+  const uint i = (get_group_id(0) * get_local_size(0) + groupRank()) * 2;
+  const uint a0 = i < n ? input[i] : 0;
+  const uint a1 = i + 1 < n ? input[i + 1] : 0;
+
+  uint total;
+  const uint prefix = groupScanExclusive(a0 + a1, scratch, &total);
+  if (i < n) {
+    output[i] = isInclusive ? prefix + a0 : prefix;
+  }
+  if (i + 1 < n) {
+    output[i + 1] = isInclusive ? prefix + a0 + a1 : prefix + a0;
+  }
+  if (get_local_id(0) == 0) {
+    blockSums[get_group_id(0)] = total;
+  }
+}
+
+
+// Adds the scanned block sums to the blocks of scanBlocks, launched with the
+// same ranges.
+__kernel void
+addBlockOffsets(
+    __global uint *data,
+    __global const uint *blockOffsets,
+    uint n)
+{
+  const uint i = get_global_id(0) * 2;
+  const uint offset = blockOffsets[get_group_id(0)];
+  if (i < n) {
+    data[i] += offset;
+  }
+  if (i + 1 < n) {
+    data[i + 1] += offset;
+  }
+}
+
+
+// Writes input[i] with flags[i] of 1 to output[offsets[i]], where offsets is
+// the exclusive scan of the flags, and the number of them to *count.
+__kernel void
+scatterIf(
+    __global uint *output,
+    __global uint *count,
+    __global const uint *input,
+    __global const uint *flags,
+    __global const uint *offsets,
+    uint n)
+{
+  const uint i = get_global_id(0);
+  if (i >= n) {
+    return;
+  }
+  if (flags[i] != 0) {
+    output[offsets[i]] = input[i];
+  }
+  if (i == n - 1) {
+    *count = offsets[i] + flags[i];
+  }
+}
+
+
+// Counts the digits of keysPerItem consecutive keys per work-item. The counts
+// are stored digit-major, histogram[digit * get_global_size(0) + item], so that
+// their exclusive scan gives each work-item its output offset for each digit.
+__kernel void
+radixHistogram(
+    __global uint *histogram,
+    __global const uint *keys,
+    uint n,
+    uint shift,
+    uint keysPerItem)
+{
+  uint counts[RADIX_SIZE];
+  for (uint d = 0; d < RADIX_SIZE; d++) {
+    counts[d] = 0;
+  }
+
+  const uint begin = get_global_id(0) * keysPerItem;
+  const uint end = min(begin + keysPerItem, n);
+  for (uint i = begin; i < end; i++) {
+    counts[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+  }
+
+  const uint nItems = get_global_size(0);
+  for (uint d = 0; d < RADIX_SIZE; d++) {
+    histogram[d * nItems + get_global_id(0)] = counts[d];
+  }
+}
+
+
+// Moves the keys counted by radixHistogram to their place. Each work-item
+// writes its keys in order, which keeps the sort stable.
+__kernel void
+radixScatter(
+    __global uint *output,
+    __global const uint *keys,
+    __global const uint *offsets,
+    uint n,
+    uint shift,
+    uint keysPerItem)
+{
+  const uint nItems = get_global_size(0);
+  uint positions[RADIX_SIZE];
+  for (uint d = 0; d < RADIX_SIZE; d++) {
+    positions[d] = offsets[d * nItems + get_global_id(0)];
+  }
+
+  const uint begin = get_global_id(0) * keysPerItem;
+  const uint end = min(begin + keysPerItem, n);
+  for (uint i = begin; i < end; i++) {
+    const uint key = keys[i];
+    output[positions[(key >> shift) & (RADIX_SIZE - 1)]++] = key;
+  }
+}
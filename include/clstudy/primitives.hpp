@@ -0,0 +1,260 @@
+#ifndef CLSTUDY_PRIMITIVES_HPP
+#define CLSTUDY_PRIMITIVES_HPP
+
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/program_cache.hpp>
+#include <clstudy/sub_group.hpp>
+
+
+namespace clstudy
+{
+
+/*!
+ * Device-side scan, stream compaction and radix sort over cl_uint buffers.
+ *
+ * The kernels live in primitives.cl, which a target has to embed (or provide
+ * through CLSTUDY_KERNEL_DIR), and are built by buildProgramFromFile(), so they
+ * share the on-disk program cache with the kernels of the samples.
+ *
+ * Every operation is enqueued on the queue given to the constructor, which has
+ * to be in-order; only compact() waits for its result. Temporary buffers are
+ * released by the runtime once the commands using them have finished.
+ * An instance is not thread-safe, since the kernels are shared between calls.
+ */
+class ParallelPrimitives
+{
+public:
+  // Bits sorted per pass of sortKeys(); RADIX_BITS of primitives.cl.
+  static constexpr std::size_t kRadixBits = 4;
+
+  ParallelPrimitives(
+    cl::Context context,
+    const std::vector<cl::Device>& devices,
+    cl::CommandQueue queue)
+    : m_context(std::move(context))
+    , m_queue(std::move(queue))
+    , m_isSubGroupUsed(isSubGroupSupported(devices))
+    , m_program(buildProgramFromFile(
+        "primitives",
+        m_context,
+        devices,
+        m_isSubGroupUsed ? getSubGroupBuildOptions(devices) + " -D USE_SUB_GROUPS" : ""))
+    , m_scanBlocksKernel(m_program, "scanBlocks")
+    , m_addBlockOffsetsKernel(m_program, "addBlockOffsets")
+    , m_scatterIfKernel(m_program, "scatterIf")
+    , m_radixHistogramKernel(m_program, "radixHistogram")
+    , m_radixScatterKernel(m_program, "radixScatter")
+    , m_localSize(calcScanLocalSize(m_scanBlocksKernel, m_queue.getInfo<CL_QUEUE_DEVICE>()))
+    , m_nComputeUnits(m_queue.getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>())
+  {}
+
+  ParallelPrimitives(const ParallelPrimitives&) = delete;
+
+  ParallelPrimitives&
+  operator=(const ParallelPrimitives&) = delete;
+
+  // Whether the work-group scan uses cl_khr_subgroups.
+  bool
+  isSubGroupUsed() const noexcept
+  {
+    return m_isSubGroupUsed;
+  }
+
+  // output[i] = input[0] + ... + input[i - 1]; output may be input.
+  void
+  exclusiveScan(const cl::Buffer& input, const cl::Buffer& output, std::size_t n)
+  {
+    scan(input, output, n, false);
+  }
+
+  // output[i] = input[0] + ... + input[i]; output may be input.
+  void
+  inclusiveScan(const cl::Buffer& input, const cl::Buffer& output, std::size_t n)
+  {
+    scan(input, output, n, true);
+  }
+
+  /*!
+   * Copy the elements of input whose flag is 1 to the front of output, keeping
+   * their order, and return how many were copied. Flags must be 0 or 1.
+   */
+  std::size_t
+  compact(
+    const cl::Buffer& input,
+    const cl::Buffer& flags,
+    const cl::Buffer& output,
+    std::size_t n)
+  {
+    if (n == 0) {
+      return 0;
+    }
+    checkSize(n);
+
+    cl::Buffer offsets{m_context, CL_MEM_READ_WRITE, sizeof(cl_uint) * n};
+    cl::Buffer count{m_context, CL_MEM_WRITE_ONLY, sizeof(cl_uint)};
+    exclusiveScan(flags, offsets, n);
+
+    m_scatterIfKernel.setArg(0, output);
+    m_scatterIfKernel.setArg(1, count);
+    m_scatterIfKernel.setArg(2, input);
+    m_scatterIfKernel.setArg(3, flags);
+    m_scatterIfKernel.setArg(4, offsets);
+    m_scatterIfKernel.setArg(5, static_cast<cl_uint>(n));
+    m_queue.enqueueNDRangeKernel(
+      m_scatterIfKernel,
+      cl::NullRange,
+      cl::NDRange{roundUp(n, m_localSize)},
+      cl::NDRange{m_localSize});
+
+    cl_uint hostCount = 0;
+    m_queue.enqueueReadBuffer(count, CL_TRUE, 0, sizeof(hostCount), &hostCount);
+    return hostCount;
+  }
+
+  /*!
+   * Sort n keys in ascending order with an LSD radix sort of kRadixBits bits
+   * per pass. Every pass counts digits per work-item, scans the counts with
+   * exclusiveScan() and scatters the keys stably into a temporary buffer.
+   */
+  void
+  sortKeys(const cl::Buffer& keys, std::size_t n)
+  {
+    static_assert(32 % (kRadixBits * 2) == 0, "[ParallelPrimitives] Keys have to end up in the input buffer.");
+    constexpr std::size_t kRadixSize = std::size_t{1} << kRadixBits;
+    // Fewer keys per work-item would make the counts outgrow the keys.
+    constexpr std::size_t kMinKeysPerItem = kRadixSize;
+    // Work-items per compute unit to keep busy.
+    constexpr std::size_t kItemsPerComputeUnit = 1024;
+
+    if (n <= 1) {
+      return;
+    }
+    checkSize(n);
+
+    const auto keysPerItem = std::max(
+      kMinKeysPerItem,
+      (n + m_nComputeUnits * kItemsPerComputeUnit - 1) / (m_nComputeUnits * kItemsPerComputeUnit));
+    const auto nItems = roundUp((n + keysPerItem - 1) / keysPerItem, m_localSize);
+    checkSize(nItems * kRadixSize);
+
+    cl::Buffer tmpKeys{m_context, CL_MEM_READ_WRITE, sizeof(cl_uint) * n};
+    cl::Buffer histogram{m_context, CL_MEM_READ_WRITE, sizeof(cl_uint) * nItems * kRadixSize};
+    auto src = keys;
+    auto dst = tmpKeys;
+    for (cl_uint shift = 0; shift < 32; shift += kRadixBits) {
+      m_radixHistogramKernel.setArg(0, histogram);
+      m_radixHistogramKernel.setArg(1, src);
+      m_radixHistogramKernel.setArg(2, static_cast<cl_uint>(n));
+      m_radixHistogramKernel.setArg(3, shift);
+      m_radixHistogramKernel.setArg(4, static_cast<cl_uint>(keysPerItem));
+      m_queue.enqueueNDRangeKernel(m_radixHistogramKernel, cl::NullRange, cl::NDRange{nItems}, cl::NullRange);
+
+      exclusiveScan(histogram, histogram, nItems * kRadixSize);
+
+      m_radixScatterKernel.setArg(0, dst);
+      m_radixScatterKernel.setArg(1, src);
+      m_radixScatterKernel.setArg(2, histogram);
+      m_radixScatterKernel.setArg(3, static_cast<cl_uint>(n));
+      m_radixScatterKernel.setArg(4, shift);
+      m_radixScatterKernel.setArg(5, static_cast<cl_uint>(keysPerItem));
+      m_queue.enqueueNDRangeKernel(m_radixScatterKernel, cl::NullRange, cl::NDRange{nItems}, cl::NullRange);
+
+      std::swap(src, dst);
+    }
+  }
+
+private:
+  static std::size_t
+  roundUp(std::size_t x, std::size_t n) noexcept
+  {
+    return (x + n - 1) / n * n;
+  }
+
+  // Indices are computed as 2 * get_global_id(0) in uint.
+  static void
+  checkSize(std::size_t n)
+  {
+    if (n > 0x7fffffff) {
+      throw std::invalid_argument{"[ParallelPrimitives] Too many elements: " + std::to_string(n)};
+    }
+  }
+
+  // The local scan of Blelloch needs a power-of-two local size.
+  static std::size_t
+  calcScanLocalSize(const cl::Kernel& kernel, const cl::Device& device)
+  {
+    auto maxSize = std::min<std::size_t>(
+      kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+      256);
+    const auto maxItemSizes = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+    if (!maxItemSizes.empty() && maxItemSizes[0] < maxSize) {
+      maxSize = maxItemSizes[0];
+    }
+    std::size_t localSize = 1;
+    while (localSize * 2 <= maxSize) {
+      localSize *= 2;
+    }
+    return localSize;
+  }
+
+  /*!
+   * Scan blocks of 2 * m_localSize elements, scan the block sums recursively
+   * and add them back, so that n elements take about log_{2 * m_localSize}(n)
+   * levels.
+   */
+  void
+  scan(const cl::Buffer& input, const cl::Buffer& output, std::size_t n, bool isInclusive)
+  {
+    if (n == 0) {
+      return;
+    }
+    checkSize(n);
+
+    const auto blockSize = m_localSize * 2;
+    const auto nBlocks = (n + blockSize - 1) / blockSize;
+    const cl::NDRange globalRange{nBlocks * m_localSize};
+    const cl::NDRange localRange{m_localSize};
+
+    cl::Buffer blockSums{m_context, CL_MEM_READ_WRITE, sizeof(cl_uint) * nBlocks};
+    m_scanBlocksKernel.setArg(0, output);
+    m_scanBlocksKernel.setArg(1, input);
+    m_scanBlocksKernel.setArg(2, blockSums);
+    m_scanBlocksKernel.setArg(3, cl::Local(sizeof(cl_uint) * (m_localSize + 1)));
+    m_scanBlocksKernel.setArg(4, static_cast<cl_uint>(n));
+    m_scanBlocksKernel.setArg(5, static_cast<cl_uint>(isInclusive ? 1 : 0));
+    m_queue.enqueueNDRangeKernel(m_scanBlocksKernel, cl::NullRange, globalRange, localRange);
+    if (nBlocks == 1) {
+      return;
+    }
+
+    scan(blockSums, blockSums, nBlocks, false);
+    m_addBlockOffsetsKernel.setArg(0, output);
+    m_addBlockOffsetsKernel.setArg(1, blockSums);
+    m_addBlockOffsetsKernel.setArg(2, static_cast<cl_uint>(n));
+    m_queue.enqueueNDRangeKernel(m_addBlockOffsetsKernel, cl::NullRange, globalRange, localRange);
+  }
+
+  cl::Context m_context;
+  cl::CommandQueue m_queue;
+  bool m_isSubGroupUsed;
+  cl::Program m_program;
+  cl::Kernel m_scanBlocksKernel;
+  cl::Kernel m_addBlockOffsetsKernel;
+  cl::Kernel m_scatterIfKernel;
+  cl::Kernel m_radixHistogramKernel;
+  cl::Kernel m_radixScatterKernel;
+  std::size_t m_localSize;
+  std::size_t m_nComputeUnits;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_PRIMITIVES_HPP
@@ -0,0 +1,578 @@
+#ifndef CLSTUDY_PROGRAM_CACHE_HPP
+#define CLSTUDY_PROGRAM_CACHE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/kernel_source.hpp>
+#include <clstudy/mapped_file.hpp>
+#include <clstudy/thread_pool.hpp>
+
+
+namespace clstudy
+{
+
+// Bump when the key derivation or the file layout changes.
+constexpr std::uint32_t kProgramCacheFormatVersion = 1;
+constexpr char kProgramCacheMagic[4] = {'C', 'L', 'P', 'C'};
+
+
+class Fnv1aHasher
+{
+public:
+  Fnv1aHasher&
+  update(const void* data, std::size_t size) noexcept
+  {
+    const auto bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; i++) {
+      m_state ^= bytes[i];
+      m_state *= UINT64_C(0x00000100000001b3);
+    }
+    return *this;
+  }
+
+  Fnv1aHasher&
+  update(std::uint64_t value) noexcept
+  {
+    return update(&value, sizeof(value));
+  }
+
+  // Length-prefixed, so that ("ab", "c") and ("a", "bc") do not collide.
+  Fnv1aHasher&
+  update(const std::string& str) noexcept
+  {
+    const std::uint64_t size = str.size();
+    update(size);
+    return update(str.data(), str.size());
+  }
+
+  Fnv1aHasher&
+  update(const std::vector<char>& data) noexcept
+  {
+    const std::uint64_t size = data.size();
+    update(size);
+    return update(data.data(), data.size());
+  }
+
+  std::uint64_t
+  digest() const noexcept
+  {
+    return m_state;
+  }
+
+private:
+  std::uint64_t m_state = UINT64_C(0xcbf29ce484222325);
+};
+
+
+// OpenCL C source of a program, and optionally its SPIR-V compiled offline and
+// embedded by compile_opencl_to_spirv(). The program is created from il when
+// it is not empty.
+struct ProgramSource
+{
+  std::string text;
+  std::vector<char> il;
+};
+
+
+// On-disk layout: header followed by the raw CL_PROGRAM_BINARIES payload.
+struct ProgramCacheHeader
+{
+  char magic[4];
+  std::uint32_t version;
+  std::uint64_t key;
+  std::uint64_t size;
+};
+
+
+inline std::string
+toHexString(std::uint64_t value)
+{
+  static const char kDigits[] = "0123456789abcdef";
+  std::string str(16, '0');
+  for (auto it = str.rbegin(); it != str.rend(); ++it) {
+    *it = kDigits[value & 0x0f];
+    value >>= 4;
+  }
+  return str;
+}
+
+
+inline std::uint64_t
+calcProgramCacheKey(
+  const ProgramSource& source,
+  const std::string& options,
+  const cl::Device& device)
+{
+  const cl::Platform platform{device.getInfo<CL_DEVICE_PLATFORM>()};
+  return Fnv1aHasher{}
+    .update(std::uint64_t{kProgramCacheFormatVersion})
+    .update(source.text)
+    .update(source.il)
+    .update(options)
+    .update(platform.getInfo<CL_PLATFORM_NAME>())
+    .update(platform.getInfo<CL_PLATFORM_VERSION>())
+    .update(device.getInfo<CL_DEVICE_NAME>())
+    .update(device.getInfo<CL_DRIVER_VERSION>())
+    .digest();
+}
+
+
+inline std::string
+makeProgramCachePath(const std::string& baseName, std::uint64_t key)
+{
+  return baseName + "." + toHexString(key) + ".bc";
+}
+
+
+// Binary of a single device, either mapped from a cache file or built in this
+// process. Mapped binaries are handed to clCreateProgramWithBinary() without
+// being copied.
+class ProgramBinary
+{
+public:
+  ProgramBinary()
+    : m_file()
+    , m_built()
+  {}
+
+  // Only the header is read to validate the file, so a corrupted or truncated
+  // entry is rejected without touching the rest of it.
+  bool
+  map(const std::string& filePath, std::uint64_t key)
+  {
+    clear();
+    if (!m_file.open(filePath)) {
+      return false;
+    }
+
+    ProgramCacheHeader header;
+    if (m_file.size() > sizeof(header)) {
+      std::memcpy(&header, m_file.data(), sizeof(header));
+    }
+    if (m_file.size() <= sizeof(header)
+        || std::memcmp(header.magic, kProgramCacheMagic, sizeof(header.magic)) != 0
+        || header.version != kProgramCacheFormatVersion
+        || header.key != key
+        || header.size != m_file.size() - sizeof(header)) {
+      std::cerr << "Ignore invalid program cache: " << filePath << std::endl;
+      m_file.close();
+      return false;
+    }
+    return true;
+  }
+
+  void
+  assign(std::vector<unsigned char>&& binary)
+  {
+    m_file.close();
+    m_built = std::move(binary);
+  }
+
+  void
+  clear() noexcept
+  {
+    m_file.close();
+    m_built.clear();
+  }
+
+  const unsigned char*
+  data() const noexcept
+  {
+    return m_file.isOpen() ? m_file.data() + sizeof(ProgramCacheHeader) : m_built.data();
+  }
+
+  std::size_t
+  size() const noexcept
+  {
+    return m_file.isOpen() ? m_file.size() - sizeof(ProgramCacheHeader) : m_built.size();
+  }
+
+  bool
+  empty() const noexcept
+  {
+    return size() == 0;
+  }
+
+private:
+  MappedFile m_file;
+  std::vector<unsigned char> m_built;
+};
+
+
+// Writes to a temporary file first and renames it, so that a concurrent
+// reader never sees a partially written cache entry.
+inline bool
+saveCachedBinary(
+  const std::string& filePath,
+  std::uint64_t key,
+  const std::vector<unsigned char>& binary)
+{
+  std::random_device rd;
+  const auto tmpFilePath = filePath + ".tmp" + toHexString((static_cast<std::uint64_t>(rd()) << 32) | rd());
+  {
+    std::ofstream ofs{tmpFilePath, std::ios::binary};
+    if (!ofs.is_open()) {
+      std::cerr << "Failed to open: " << tmpFilePath << std::endl;
+      return false;
+    }
+    ProgramCacheHeader header;
+    std::memcpy(header.magic, kProgramCacheMagic, sizeof(header.magic));
+    header.version = kProgramCacheFormatVersion;
+    header.key = key;
+    header.size = binary.size();
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(binary.data()), static_cast<std::streamsize>(binary.size()));
+    if (!ofs.flush()) {
+      std::cerr << "Failed to write: " << tmpFilePath << std::endl;
+      ofs.close();
+      std::remove(tmpFilePath.c_str());
+      return false;
+    }
+  }
+
+#ifdef _WIN32
+  // rename() on Windows does not replace an existing file.
+  std::remove(filePath.c_str());
+#endif  // _WIN32
+  if (std::rename(tmpFilePath.c_str(), filePath.c_str()) != 0) {
+    std::cerr << "Failed to rename: " << tmpFilePath << " -> " << filePath << std::endl;
+    std::remove(tmpFilePath.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+inline void
+saveProgramBinaries(
+  const std::string& baseName,
+  const ProgramSource& source,
+  const std::string& options,
+  const cl::Program& program)
+{
+  // CL_PROGRAM_BINARIES is ordered like CL_PROGRAM_DEVICES, not like the
+  // device list passed to the build.
+  const auto programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+  const auto builtBinaries = program.getInfo<CL_PROGRAM_BINARIES>();
+  for (decltype(programDevices)::size_type i = 0; i < programDevices.size(); i++) {
+    if (builtBinaries[i].empty()) {
+      continue;
+    }
+    const auto key = calcProgramCacheKey(source, options, programDevices[i]);
+    saveCachedBinary(makeProgramCachePath(baseName, key), key, builtBinaries[i]);
+  }
+}
+
+
+// Moves the binaries built in program into the slots of binaries, matching
+// CL_PROGRAM_DEVICES against devices by cl_device_id.
+inline void
+mergeProgramBinaries(
+  const cl::Program& program,
+  const std::vector<cl::Device>& devices,
+  std::vector<ProgramBinary>& binaries)
+{
+  const auto programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+  auto builtBinaries = program.getInfo<CL_PROGRAM_BINARIES>();
+  for (decltype(programDevices)::size_type i = 0; i < programDevices.size(); i++) {
+    if (builtBinaries[i].empty()) {
+      continue;
+    }
+    for (decltype(devices.size()) j = 0; j < devices.size(); j++) {
+      if (devices[j]() == programDevices[i]()) {
+        binaries[j].assign(std::move(builtBinaries[i]));
+        break;
+      }
+    }
+  }
+}
+
+
+// cl::Program only accepts binaries as vectors, which would force a copy of
+// every mapped file, so this calls the C API directly.
+inline cl::Program
+createProgramWithBinaries(
+  const cl::Context& context,
+  const std::vector<cl::Device>& devices,
+  const std::vector<ProgramBinary>& binaries,
+  std::vector<cl_int>& binaryStatus)
+{
+  std::vector<cl_device_id> deviceIds;
+  std::vector<const unsigned char*> binaryPtrs;
+  std::vector<std::size_t> binarySizes;
+  for (decltype(devices.size()) i = 0; i < devices.size(); i++) {
+    deviceIds.push_back(devices[i]());
+    binaryPtrs.push_back(binaries[i].data());
+    binarySizes.push_back(binaries[i].size());
+  }
+  binaryStatus.assign(devices.size(), CL_SUCCESS);
+
+  cl_int err = CL_SUCCESS;
+  const auto program = ::clCreateProgramWithBinary(
+    context(),
+    static_cast<cl_uint>(deviceIds.size()),
+    deviceIds.data(),
+    binarySizes.data(),
+    binaryPtrs.data(),
+    binaryStatus.data(),
+    &err);
+  if (err != CL_SUCCESS) {
+    throw cl::Error{err, "clCreateProgramWithBinary"};
+  }
+  return cl::Program{program};
+}
+
+
+inline cl::Program
+buildProgramFromSource(
+  const cl::Context& context,
+  const ProgramSource& source,
+  const std::vector<cl::Device>& devices,
+  const std::string& options)
+{
+#if CL_HPP_TARGET_OPENCL_VERSION >= 210 || CL_HPP_TARGET_OPENCL_VERSION == 200 && defined(CL_HPP_USE_IL_KHR)
+  if (!source.il.empty()) {
+    try {
+      cl::Program program{
+        context,
+        source.il};
+      program.build(devices, options.c_str());
+      return program;
+    } catch (const cl::Error& ex) {
+      std::cerr << "Failed to build from SPIR-V, fall back to OpenCL C: "
+                << ex.what() << "(" << ex.err() << ")" << std::endl;
+    }
+  }
+#endif  // CL_HPP_TARGET_OPENCL_VERSION >= 210 || CL_HPP_TARGET_OPENCL_VERSION == 200 && defined(CL_HPP_USE_IL_KHR)
+  cl::Program program{
+    context,
+    source.text};
+  program.build(devices, options.c_str());
+  return program;
+}
+
+
+inline bool
+isSpirvSupported(const cl::Device& device)
+{
+#if CL_HPP_TARGET_OPENCL_VERSION >= 210
+  return device.getInfo<CL_DEVICE_IL_VERSION>().find("SPIR-V") != std::string::npos;
+#elif CL_HPP_TARGET_OPENCL_VERSION == 200 && defined(CL_HPP_USE_IL_KHR)
+  // cl2.hpp calls clCreateProgramWithILKHR without checking that it exists.
+  return device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_il_program") != std::string::npos
+    && device.getInfo<CL_DEVICE_IL_VERSION_KHR>().find("SPIR-V") != std::string::npos;
+#else
+  static_cast<void>(device);
+  return false;
+#endif  // CL_HPP_TARGET_OPENCL_VERSION >= 210
+}
+
+
+/*!
+ * SPIR-V of baseName if every device accepts it. Only targets which ran
+ * compile_opencl_to_spirv() have it embedded, next to the source it was
+ * compiled from; the filesystem is never searched.
+ *
+ * The SPIR-V is skipped when build options are given, since preprocessor
+ * definitions cannot be applied to it any more, and when CLSTUDY_KERNEL_DIR
+ * overrides the OpenCL C source, since the SPIR-V may be stale then.
+ */
+inline std::vector<char>
+loadKernelIL(
+  const std::string& baseName,
+  const std::vector<cl::Device>& devices,
+  const std::string& options)
+{
+  std::vector<char> il;
+  const auto kernelDir = std::getenv("CLSTUDY_KERNEL_DIR");
+  if (!options.empty() || (kernelDir != nullptr && kernelDir[0] != '\0')) {
+    return il;
+  }
+  for (const auto& device : devices) {
+    if (!isSpirvSupported(device)) {
+      return il;
+    }
+  }
+
+  KernelSourceRegistry::getInstance().findIL(baseName, il);
+  return il;
+}
+
+
+/*!
+ * Build source for the given devices, going through the binary cache.
+ *
+ * Compiled binaries are cached per device as "<baseName>.<key>.bc", where key
+ * is a hash of the source, the build options, the platform, the device name and
+ * the driver version. Any change of them results in a cache miss.
+ *
+ * Only the devices whose binary is missing or rejected by the runtime are built
+ * from source; their fresh binaries are merged with the cached ones, so the
+ * returned program always covers all of the given devices.
+ */
+inline cl::Program
+buildCachedProgram(
+  const std::string& baseName,
+  const ProgramSource& source,
+  const cl::Context& context,
+  const std::vector<cl::Device>& devices,
+  const std::string& options = "",
+  bool saveBinary = true)
+{
+  std::vector<ProgramBinary> binaries(devices.size());
+  for (decltype(devices.size()) i = 0; i < devices.size(); i++) {
+    const auto key = calcProgramCacheKey(source, options, devices[i]);
+    binaries[i].map(makeProgramCachePath(baseName, key), key);
+  }
+
+  // The second pass only happens when a binary we have just built ourselves
+  // is rejected, which leaves no reason to trust the cache any more.
+  for (int pass = 0; pass < 2; pass++) {
+    std::vector<cl::Device> missingDevices;
+    for (decltype(devices.size()) i = 0; i < devices.size(); i++) {
+      if (binaries[i].empty()) {
+        missingDevices.push_back(devices[i]);
+      }
+    }
+
+    if (missingDevices.size() == devices.size()) {
+      break;
+    }
+    if (!missingDevices.empty()) {
+      const auto partialProgram = buildProgramFromSource(context, source, missingDevices, options);
+      if (saveBinary) {
+        saveProgramBinaries(baseName, source, options, partialProgram);
+      }
+      mergeProgramBinaries(partialProgram, devices, binaries);
+    }
+
+    std::vector<cl_int> binaryStatus;
+    cl::Program program;
+    try {
+      program = createProgramWithBinaries(
+        context,
+        devices,
+        binaries,
+        binaryStatus);
+      program.build(devices, options.c_str());
+      return program;
+    } catch (const cl::Error& ex) {
+      std::cerr << "Cached binary of " << baseName << " is rejected: "
+                << ex.what() << "(" << ex.err() << ")" << std::endl;
+    }
+
+    auto nRejected = 0;
+    for (decltype(devices.size()) i = 0; i < devices.size(); i++) {
+      const auto isRejected = (binaryStatus.size() == devices.size() && binaryStatus[i] != CL_SUCCESS)
+        || (program() != nullptr && program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devices[i]) != CL_BUILD_SUCCESS);
+      if (isRejected) {
+        std::cerr << "  Rebuild for " << devices[i].getInfo<CL_DEVICE_NAME>() << std::endl;
+        binaries[i].clear();
+        nRejected++;
+      }
+    }
+    if (nRejected == 0) {
+      break;
+    }
+  }
+
+  auto program = buildProgramFromSource(context, source, devices, options);
+  if (saveBinary) {
+    saveProgramBinaries(baseName, source, options, program);
+  }
+  return program;
+}
+
+
+/*!
+ * Build the kernel source named baseName (see loadKernelSource()) for the given
+ * devices with buildCachedProgram(). The program is created from the embedded
+ * SPIR-V instead when all devices accept it (see loadKernelIL()).
+ */
+inline cl::Program
+buildProgramFromFile(
+  const std::string& baseName,
+  const cl::Context& context,
+  const std::vector<cl::Device>& devices,
+  const std::string& options = "",
+  bool saveBinary = true)
+{
+  const ProgramSource source{
+    loadKernelSource(baseName),
+    loadKernelIL(baseName, devices, options)};
+  return buildCachedProgram(baseName, source, context, devices, options, saveBinary);
+}
+
+
+inline cl::Program
+buildProgramFromFile(
+  const std::string& baseName,
+  const std::string& options = "",
+  bool saveBinary = true)
+{
+  const auto context = cl::Context::getDefault();
+  return buildProgramFromFile(
+    baseName,
+    context,
+    context.getInfo<CL_CONTEXT_DEVICES>(),
+    options,
+    saveBinary);
+}
+
+
+/*!
+ * Run buildProgramFromFile() on a worker of pool, so that the caller can set up
+ * host data while the program compiles.
+ *
+ * With several devices, each device is first compiled by its own worker to
+ * fill the cache, and the final build then only loads the cached binaries.
+ * All of them build the same ProgramSource, whose IL is chosen for the whole
+ * device list, so that the cache keys of both builds agree.
+ */
+inline std::future<cl::Program>
+buildProgramFromFileAsync(
+  ThreadPool& pool,
+  const std::string& baseName,
+  const cl::Context& context,
+  const std::vector<cl::Device>& devices,
+  const std::string& options = "",
+  bool saveBinary = true)
+{
+  const std::shared_future<ProgramSource> sourceFuture = pool.submit([=] {
+    return ProgramSource{
+      loadKernelSource(baseName),
+      loadKernelIL(baseName, devices, options)};
+  });
+  std::vector<std::shared_future<cl::Program>> perDeviceFutures;
+  if (saveBinary && devices.size() > 1 && pool.size() > 1) {
+    for (const auto& device : devices) {
+      perDeviceFutures.emplace_back(pool.submit([=] {
+        return buildCachedProgram(baseName, sourceFuture.get(), context, {device}, options, saveBinary);
+      }));
+    }
+  }
+  // Tasks run in FIFO order, so the tasks waited on here have been picked up
+  // before this one can wait on them.
+  return pool.submit([=] {
+    for (const auto& future : perDeviceFutures) {
+      future.wait();
+    }
+    return buildCachedProgram(baseName, sourceFuture.get(), context, devices, options, saveBinary);
+  });
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_PROGRAM_CACHE_HPP
@@ -0,0 +1,317 @@
+#ifndef CLSTUDY_STAGING_POOL_HPP
+#define CLSTUDY_STAGING_POOL_HPP
+
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+
+
+namespace clstudy
+{
+
+class StagingBufferPool;
+
+
+struct StagingPoolStats
+{
+  std::size_t nAcquired;
+  // Acquisitions which had to allocate and map a new buffer
+  std::size_t nAllocated;
+  // Bytes of all buffers of the pool, leased or not
+  std::size_t totalBytes;
+};
+
+
+/*!
+ * Pinned host memory of a StagingBufferPool, leased until destruction or
+ * release(). The memory is mapped for the whole lease; fill it through data()
+ * and copy it to device buffers with copyTo().
+ *
+ * The copies are non-blocking. The buffer goes back to the pool on release,
+ * but it is handed out again only once they have completed, so the lease can
+ * be released right after the last copyTo(). A lease has to be released
+ * before its pool is destroyed.
+ */
+class StagingLease
+{
+public:
+  StagingLease() noexcept
+    : m_pool(nullptr)
+    , m_slot(nullptr)
+    , m_size(0)
+  {}
+
+  StagingLease(const StagingLease&) = delete;
+
+  StagingLease&
+  operator=(const StagingLease&) = delete;
+
+  StagingLease(StagingLease&& other) noexcept
+    : m_pool(std::exchange(other.m_pool, nullptr))
+    , m_slot(std::exchange(other.m_slot, nullptr))
+    , m_size(std::exchange(other.m_size, 0))
+  {}
+
+  StagingLease&
+  operator=(StagingLease&& other) noexcept
+  {
+    if (this != &other) {
+      release();
+      m_pool = std::exchange(other.m_pool, nullptr);
+      m_slot = std::exchange(other.m_slot, nullptr);
+      m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+  }
+
+  ~StagingLease()
+  {
+    release();
+  }
+
+  explicit operator bool() const noexcept
+  {
+    return m_slot != nullptr;
+  }
+
+  void*
+  data() const noexcept;
+
+  template<typename T>
+  T*
+  data() const noexcept
+  {
+    return static_cast<T*>(data());
+  }
+
+  // Bytes requested from acquire()
+  std::size_t
+  size() const noexcept
+  {
+    return m_size;
+  }
+
+  // Bytes of the underlying buffer, a power of two not smaller than size()
+  std::size_t
+  capacity() const noexcept;
+
+  /*!
+   * Enqueue a non-blocking enqueueWriteBuffer() of the first size bytes of
+   * the lease to dst at dstOffset, and return its event.
+   */
+  cl::Event
+  copyTo(
+    const cl::CommandQueue& queue,
+    const cl::Buffer& dst,
+    std::size_t size,
+    std::size_t dstOffset = 0,
+    const std::vector<cl::Event>* waitList = nullptr);
+
+  // Copy all size() bytes.
+  cl::Event
+  copyTo(const cl::CommandQueue& queue, const cl::Buffer& dst)
+  {
+    return copyTo(queue, dst, m_size);
+  }
+
+  // Give the buffer back to the pool; the lease is empty afterwards.
+  void
+  release() noexcept;
+
+private:
+  friend class StagingBufferPool;
+
+  struct Slot;
+
+  StagingLease(StagingBufferPool* pool, Slot* slot, std::size_t size) noexcept
+    : m_pool(pool)
+    , m_slot(slot)
+    , m_size(size)
+  {}
+
+  StagingBufferPool* m_pool;
+  Slot* m_slot;
+  std::size_t m_size;
+};
+
+
+// A CL_MEM_ALLOC_HOST_PTR buffer, mapped as long as it is in the pool
+struct StagingLease::Slot
+{
+  cl::Buffer buffer;
+  void* ptr;
+  std::size_t capacity;
+  // Copies from ptr which may still be running
+  std::vector<cl::Event> pending;
+  bool isLeased;
+};
+
+
+/*!
+ * Pool of pinned staging buffers for transfers to devices, so that the
+ * requests of a long-running process do not allocate, pin and map host memory
+ * every time.
+ *
+ * Buffers are allocated with CL_MEM_ALLOC_HOST_PTR in power-of-two size
+ * classes of at least kMinCapacity bytes, mapped once for reading and
+ * writing, and kept mapped until the pool is destroyed. acquire() hands out
+ * an idle buffer of the size class whose copies have completed, and
+ * allocates one otherwise. Thread-safe.
+ */
+class StagingBufferPool
+{
+public:
+  static constexpr std::size_t kMinCapacity = 64 * 1024;
+
+  /*!
+   * queue maps and unmaps the buffers; transfers can use any queue of
+   * context.
+   */
+  StagingBufferPool(cl::Context context, cl::CommandQueue queue)
+    : m_context(std::move(context))
+    , m_queue(std::move(queue))
+    , m_mutex()
+    , m_slots()
+    , m_stats{0, 0, 0}
+  {}
+
+  StagingBufferPool(const StagingBufferPool&) = delete;
+
+  StagingBufferPool&
+  operator=(const StagingBufferPool&) = delete;
+
+  ~StagingBufferPool()
+  {
+    // A failed transfer must not keep the other slots mapped; nothing is left
+    // to do for buffers which are released anyway.
+    for (const auto& slot : m_slots) {
+      try {
+        cl::Event::waitForEvents(slot->pending);
+      } catch (...) {
+      }
+      try {
+        m_queue.enqueueUnmapMemObject(slot->buffer, slot->ptr);
+      } catch (...) {
+      }
+    }
+    try {
+      m_queue.finish();
+    } catch (...) {
+    }
+  }
+
+  StagingLease
+  acquire(std::size_t size)
+  {
+    const auto capacity = calcCapacity(size);
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_stats.nAcquired++;
+    for (const auto& slot : m_slots) {
+      if (!slot->isLeased && slot->capacity == capacity && isCompleted(*slot)) {
+        slot->pending.clear();
+        slot->isLeased = true;
+        return StagingLease{this, slot.get(), size};
+      }
+    }
+
+    cl::Buffer buffer{m_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, capacity};
+    const auto ptr = m_queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, capacity);
+    m_slots.push_back(std::unique_ptr<StagingLease::Slot>{new StagingLease::Slot{std::move(buffer), ptr, capacity, {}, true}});
+    m_stats.nAllocated++;
+    m_stats.totalBytes += capacity;
+    return StagingLease{this, m_slots.back().get(), size};
+  }
+
+  StagingPoolStats
+  stats() const
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return m_stats;
+  }
+
+private:
+  friend class StagingLease;
+
+  static std::size_t
+  calcCapacity(std::size_t size) noexcept
+  {
+    auto capacity = kMinCapacity;
+    while (capacity < size) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  static bool
+  isCompleted(const StagingLease::Slot& slot)
+  {
+    return std::all_of(std::cbegin(slot.pending), std::cend(slot.pending), [](const auto& event) {
+      // A negative status is an error, after which the command will not run.
+      return event.template getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() <= CL_COMPLETE;
+    });
+  }
+
+  void
+  release(StagingLease::Slot* slot) noexcept
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    slot->isLeased = false;
+  }
+
+  cl::Context m_context;
+  cl::CommandQueue m_queue;
+  mutable std::mutex m_mutex;
+  std::vector<std::unique_ptr<StagingLease::Slot>> m_slots;
+  StagingPoolStats m_stats;
+};
+
+
+inline void*
+StagingLease::data() const noexcept
+{
+  return m_slot == nullptr ? nullptr : m_slot->ptr;
+}
+
+
+inline std::size_t
+StagingLease::capacity() const noexcept
+{
+  return m_slot == nullptr ? 0 : m_slot->capacity;
+}
+
+
+inline cl::Event
+StagingLease::copyTo(
+  const cl::CommandQueue& queue,
+  const cl::Buffer& dst,
+  std::size_t size,
+  std::size_t dstOffset,
+  const std::vector<cl::Event>* waitList)
+{
+  cl::Event event;
+  queue.enqueueWriteBuffer(dst, CL_FALSE, dstOffset, size, m_slot->ptr, waitList, &event);
+  m_slot->pending.push_back(event);
+  return event;
+}
+
+
+inline void
+StagingLease::release() noexcept
+{
+  if (m_slot != nullptr) {
+    m_pool->release(m_slot);
+    m_pool = nullptr;
+    m_slot = nullptr;
+    m_size = 0;
+  }
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_STAGING_POOL_HPP
@@ -0,0 +1,110 @@
+#ifndef CLSTUDY_SUB_GROUP_HPP
+#define CLSTUDY_SUB_GROUP_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/device.hpp>
+
+
+// cl::Kernel::getSubGroupInfo() is available from OpenCL 2.1, or at 2.0 with
+// the generator option USE_CL_SUB_GROUPS_KHR.
+#if CL_HPP_TARGET_OPENCL_VERSION >= 210 || CL_HPP_TARGET_OPENCL_VERSION == 200 && defined(CL_HPP_USE_CL_SUB_GROUPS_KHR)
+#  define CLSTUDY_HAS_SUB_GROUP_INFO
+#endif  // CL_HPP_TARGET_OPENCL_VERSION >= 210 || CL_HPP_TARGET_OPENCL_VERSION == 200 && defined(CL_HPP_USE_CL_SUB_GROUPS_KHR)
+
+
+namespace clstudy
+{
+
+/*!
+ * Whether device can run the sub-group kernels: it has to report
+ * cl_khr_subgroups, and compile OpenCL C 2.0 to which the built-ins belong.
+ * Always false when the host side cannot query sub-group sizes.
+ */
+inline bool
+isSubGroupSupported(const cl::Device& device)
+{
+#ifdef CLSTUDY_HAS_SUB_GROUP_INFO
+  return hasExtension(device, "cl_khr_subgroups")
+    && getOpenCLCMajorVersion(device) >= 2;
+#else
+  static_cast<void>(device);
+  return false;
+#endif  // CLSTUDY_HAS_SUB_GROUP_INFO
+}
+
+
+inline bool
+isSubGroupSupported(const std::vector<cl::Device>& devices)
+{
+  for (const auto& device : devices) {
+    if (!isSubGroupSupported(device)) {
+      return false;
+    }
+  }
+  return !devices.empty();
+}
+
+
+// Build options which enable the sub-group kernels on devices, if any.
+inline std::string
+getSubGroupBuildOptions(const std::vector<cl::Device>& devices)
+{
+  return isSubGroupSupported(devices) ? "-cl-std=CL2.0" : "";
+}
+
+
+struct SubGroupLaunch
+{
+  std::size_t localSize;
+  std::size_t subGroupSize;
+  std::size_t nSubGroups;
+};
+
+
+/*!
+ * Largest local size up to maxLocalSize that is a whole number of sub-groups
+ * of kernel on device, so that no sub-group is partially filled.
+ * Returns a localSize of 0 when sub-group sizes cannot be queried.
+ */
+inline SubGroupLaunch
+chooseSubGroupLaunch(
+  const cl::Kernel& kernel,
+  const cl::Device& device,
+  std::size_t maxLocalSize)
+{
+#ifdef CLSTUDY_HAS_SUB_GROUP_INFO
+  auto localSize = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+  if (maxLocalSize < localSize) {
+    localSize = maxLocalSize;
+  }
+#  if CL_HPP_TARGET_OPENCL_VERSION >= 210
+  constexpr auto kMaxSubGroupSize = CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE;
+  constexpr auto kSubGroupCount = CL_KERNEL_SUB_GROUP_COUNT_FOR_NDRANGE;
+#  else
+  constexpr auto kMaxSubGroupSize = CL_KERNEL_MAX_SUB_GROUP_SIZE_FOR_NDRANGE_KHR;
+  constexpr auto kSubGroupCount = CL_KERNEL_SUB_GROUP_COUNT_FOR_NDRANGE_KHR;
+#  endif  // CL_HPP_TARGET_OPENCL_VERSION >= 210
+  const auto subGroupSize = kernel.getSubGroupInfo<kMaxSubGroupSize>(device, cl::NDRange{localSize});
+  if (subGroupSize != 0 && subGroupSize <= localSize) {
+    localSize = localSize / subGroupSize * subGroupSize;
+  }
+  // The implementation may split the rounded local size differently, so ask
+  // again for the count, which sizes per-sub-group scratch memory.
+  const auto nSubGroups = kernel.getSubGroupInfo<kSubGroupCount>(device, cl::NDRange{localSize});
+  return {localSize, subGroupSize, nSubGroups};
+#else
+  static_cast<void>(kernel);
+  static_cast<void>(device);
+  static_cast<void>(maxLocalSize);
+  return {0, 0, 0};
+#endif  // CLSTUDY_HAS_SUB_GROUP_INFO
+}
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_SUB_GROUP_HPP
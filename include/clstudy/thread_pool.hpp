@@ -0,0 +1,122 @@
+#ifndef CLSTUDY_THREAD_POOL_HPP
+#define CLSTUDY_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace clstudy
+{
+
+class ThreadPool
+{
+public:
+  /*!
+   * initThread, if any, is called first on every worker thread, e.g. to set
+   * its CPU affinity.
+   */
+  explicit ThreadPool(
+    std::size_t nThreads = std::thread::hardware_concurrency(),
+    std::function<void()> initThread = nullptr)
+    : m_threads()
+    , m_tasks()
+    , m_mutex()
+    , m_cv()
+    , m_isStopping(false)
+  {
+    if (nThreads == 0) {
+      nThreads = 1;
+    }
+    m_threads.reserve(nThreads);
+    for (std::size_t i = 0; i < nThreads; i++) {
+      m_threads.emplace_back([this, initThread] {
+        if (initThread) {
+          initThread();
+        }
+        workerMain();
+      });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+
+  ThreadPool&
+  operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      m_isStopping = true;
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  template<
+    typename F,
+    typename R = decltype(std::declval<typename std::decay<F>::type&>()())
+  >
+  std::future<R>
+  submit(F&& f)
+  {
+    const auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    auto future = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock{m_mutex};
+      m_tasks.emplace_back([task] {
+        (*task)();
+      });
+    }
+    m_cv.notify_one();
+    return future;
+  }
+
+  std::size_t
+  size() const noexcept
+  {
+    return m_threads.size();
+  }
+
+private:
+  void
+  workerMain()
+  {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        m_cv.wait(lock, [this] {
+          return m_isStopping || !m_tasks.empty();
+        });
+        if (m_tasks.empty()) {
+          return;
+        }
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> m_threads;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_isStopping;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_THREAD_POOL_HPP
@@ -0,0 +1,368 @@
+#ifndef CLSTUDY_VERIFY_HPP
+#define CLSTUDY_VERIFY_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/host_compute.hpp>
+
+
+namespace clstudy
+{
+
+/*!
+ * Distance between x and y in units in the last place, i.e. the number of
+ * representable floats from one to the other; +0 and -0 are 0 apart.
+ * Returns the maximum of std::uint32_t if either is NaN.
+ */
+inline std::uint32_t
+calcUlpDistance(float x, float y) noexcept
+{
+  if (std::isnan(x) || std::isnan(y)) {
+    return std::numeric_limits<std::uint32_t>::max();
+  }
+  std::int32_t ix;
+  std::int32_t iy;
+  std::memcpy(&ix, &x, sizeof(ix));
+  std::memcpy(&iy, &y, sizeof(iy));
+  // Map the sign-magnitude representation to a monotonic integer.
+  const auto ox = ix < 0 ? std::int64_t{std::numeric_limits<std::int32_t>::min()} - ix : std::int64_t{ix};
+  const auto oy = iy < 0 ? std::int64_t{std::numeric_limits<std::int32_t>::min()} - iy : std::int64_t{iy};
+  const auto distance = ox < oy ? oy - ox : ox - oy;
+  return static_cast<std::uint32_t>(std::min<std::int64_t>(distance, std::numeric_limits<std::uint32_t>::max()));
+}
+
+
+/*!
+ * Accepted difference between an expected and an actual value: either at
+ * most maxUlps apart, or |expected - actual| <= maxRelative * |expected| +
+ * maxAbsolute. NaN is never accepted. The default accepts equal values only.
+ */
+struct Tolerance
+{
+  std::uint32_t maxUlps;
+  float maxRelative;
+  float maxAbsolute;
+
+  static Tolerance
+  ulps(std::uint32_t maxUlps) noexcept
+  {
+    return Tolerance{maxUlps, 0.0f, 0.0f};
+  }
+
+  static Tolerance
+  relative(float maxRelative, float maxAbsolute = 0.0f) noexcept
+  {
+    return Tolerance{0, maxRelative, maxAbsolute};
+  }
+
+  bool
+  accepts(float expected, float actual) const noexcept
+  {
+    if (std::isnan(expected) || std::isnan(actual)) {
+      return false;
+    }
+    return std::abs(expected - actual) <= maxRelative * std::abs(expected) + maxAbsolute
+      || calcUlpDistance(expected, actual) <= maxUlps;
+  }
+};
+
+
+struct Mismatch
+{
+  std::size_t index;
+  float expected;
+  float actual;
+};
+
+
+struct VerifyReport
+{
+  // Number of rejected elements; a lower bound if isStoppedEarly
+  std::size_t nMismatches;
+  // The first ones by index, up to the limit of the verifier
+  std::vector<Mismatch> mismatches;
+  bool isStoppedEarly;
+
+  bool
+  isOk() const noexcept
+  {
+    return nMismatches == 0;
+  }
+};
+
+
+// Print the reported mismatches and their total, indented for the samples.
+inline void
+printMismatches(std::ostream& os, const VerifyReport& report)
+{
+  for (const auto& mismatch : report.mismatches) {
+    os << "  [" << mismatch.index << "] expected " << mismatch.expected
+       << ", actual " << mismatch.actual
+       << " (" << calcUlpDistance(mismatch.expected, mismatch.actual) << " ulps)" << std::endl;
+  }
+  if (!report.isOk()) {
+    os << "  " << (report.isStoppedEarly ? "At least " : "") << report.nMismatches
+       << " mismatches" << std::endl;
+  }
+}
+
+
+/*!
+ * Call f(i) for each i in [0, n) whose pair tolerance rejects, in increasing
+ * order, as long as f returns true.
+ */
+template<typename F>
+inline void
+forEachMismatchScalar(const Tolerance& tolerance, const float* expected, const float* actual, std::size_t n, F f)
+{
+  for (std::size_t i = 0; i < n; i++) {
+    if (!tolerance.accepts(expected[i], actual[i]) && !f(i)) {
+      return;
+    }
+  }
+}
+
+
+#if defined(CLSTUDY_HOST_AVX2)
+/*!
+ * forEachMismatchScalar() which tests eight pairs at once. Lanes the vector
+ * test does not accept, including pairs of different signs, are tested again
+ * by Tolerance::accepts(), so both report the same indices.
+ */
+template<typename F>
+#  ifdef CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+__attribute__((target("avx2")))
+#  endif  // CLSTUDY_HOST_SIMD_RUNTIME_DISPATCH
+inline void
+forEachMismatchAvx2(const Tolerance& tolerance, const float* expected, const float* actual, std::size_t n, F f)
+{
+  const auto maxRelative = _mm256_set1_ps(tolerance.maxRelative);
+  const auto maxAbsolute = _mm256_set1_ps(tolerance.maxAbsolute);
+  const auto maxUlps = _mm256_set1_epi32(static_cast<int>(std::min<std::uint32_t>(tolerance.maxUlps, 0x7fffffff)));
+  const auto magnitudeMask = _mm256_set1_epi32(0x7fffffff);
+  const auto absMask = _mm256_castsi256_ps(magnitudeMask);
+
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const auto x = _mm256_loadu_ps(expected + i);
+    const auto y = _mm256_loadu_ps(actual + i);
+    const auto diff = _mm256_and_ps(absMask, _mm256_sub_ps(x, y));
+    const auto bound = _mm256_add_ps(_mm256_mul_ps(maxRelative, _mm256_and_ps(absMask, x)), maxAbsolute);
+    const auto isRelativeOk = _mm256_castps_si256(_mm256_cmp_ps(diff, bound, _CMP_LE_OQ));
+
+    // Within one sign, flipping the magnitude of negatives makes the bits
+    // monotonic, and the difference fits in 31 bits.
+    const auto xi = _mm256_castps_si256(x);
+    const auto yi = _mm256_castps_si256(y);
+    const auto ox = _mm256_xor_si256(xi, _mm256_and_si256(_mm256_srai_epi32(xi, 31), magnitudeMask));
+    const auto oy = _mm256_xor_si256(yi, _mm256_and_si256(_mm256_srai_epi32(yi, 31), magnitudeMask));
+    const auto ulps = _mm256_abs_epi32(_mm256_sub_epi32(ox, oy));
+    const auto isSignDifferent = _mm256_srai_epi32(_mm256_xor_si256(xi, yi), 31);
+    const auto isUlpNg = _mm256_or_si256(isSignDifferent, _mm256_cmpgt_epi32(ulps, maxUlps));
+
+    const auto isOrdered = _mm256_castps_si256(_mm256_cmp_ps(x, y, _CMP_ORD_Q));
+    const auto isOk = _mm256_and_si256(isOrdered, _mm256_or_si256(isRelativeOk, _mm256_xor_si256(isUlpNg, _mm256_set1_epi32(-1))));
+    auto ngMask = static_cast<unsigned int>(~_mm256_movemask_ps(_mm256_castsi256_ps(isOk))) & 0xffu;
+    for (std::size_t lane = 0; ngMask != 0; lane++, ngMask >>= 1) {
+      if ((ngMask & 1u) != 0 && !tolerance.accepts(expected[i + lane], actual[i + lane]) && !f(i + lane)) {
+        return;
+      }
+    }
+  }
+  forEachMismatchScalar(tolerance, expected + i, actual + i, n - i, [&f, i](std::size_t j) {
+    return f(i + j);
+  });
+}
+#endif  // defined(CLSTUDY_HOST_AVX2)
+
+
+/*!
+ * Compares results of a device with expected values on the threads and with
+ * the SIMD kernels of a HostCompute.
+ *
+ * Results can be given at once to verify(), or in chunks of increasing offset
+ * to verifyChunk(), e.g. while they are read back; verifyBuffer() maps a
+ * buffer one chunk at a time, so that no host copy of the whole result is
+ * needed. The first maxReported mismatches by index are kept with their
+ * values. With isStopEarly, comparison stops once that many are found.
+ */
+class ResultVerifier
+{
+public:
+  static constexpr std::size_t kDefaultChunkSize = 1 << 22;
+
+  ResultVerifier(
+    HostCompute& hostCompute,
+    const Tolerance& tolerance,
+    std::size_t maxReported = 8,
+    bool isStopEarly = false)
+    : m_hostCompute(hostCompute)
+    , m_tolerance(tolerance)
+    , m_maxReported(maxReported)
+    , m_isStopEarly(isStopEarly)
+    , m_report{0, {}, false}
+  {}
+
+  const VerifyReport&
+  report() const noexcept
+  {
+    return m_report;
+  }
+
+  void
+  reset() noexcept
+  {
+    m_report.nMismatches = 0;
+    m_report.mismatches.clear();
+    m_report.isStoppedEarly = false;
+  }
+
+  // Whether further chunks would not change the report.
+  bool
+  isStopped() const noexcept
+  {
+    return m_report.isStoppedEarly;
+  }
+
+  const VerifyReport&
+  verify(const float* expected, const float* actual, std::size_t n)
+  {
+    reset();
+    verifyChunk(0, expected, actual, n);
+    return m_report;
+  }
+
+  /*!
+   * Compare actual[0, n) with expected[0, n), which are the elements from
+   * offset on of the whole result. Returns whether they all match.
+   */
+  bool
+  verifyChunk(std::size_t offset, const float* expected, const float* actual, std::size_t n)
+  {
+    if (isStopped()) {
+      return false;
+    }
+    const auto nSlots = m_maxReported - std::min(m_maxReported, m_report.mismatches.size());
+    const auto simd = m_hostCompute.simd();
+    const auto tolerance = m_tolerance;
+    const auto isStopEarly = m_isStopEarly;
+
+    std::mutex mutex;
+    std::size_t nMismatches = 0;
+    std::vector<Mismatch> mismatches;
+    auto isStoppedEarly = false;
+    m_hostCompute.parallelFor(n, [&](std::size_t begin, std::size_t end) {
+      // The first nSlots of each range include the first nSlots of all.
+      std::size_t localCount = 0;
+      std::vector<Mismatch> localMismatches;
+      auto isLocalStopped = false;
+      const auto onMismatch = [&](std::size_t i) {
+        localCount++;
+        if (localMismatches.size() < nSlots) {
+          localMismatches.push_back(Mismatch{offset + begin + i, expected[begin + i], actual[begin + i]});
+        }
+        isLocalStopped = isStopEarly && localCount >= std::max<std::size_t>(nSlots, 1);
+        return !isLocalStopped;
+      };
+#if defined(CLSTUDY_HOST_AVX2)
+      if (simd >= HostSimd::kAvx2) {
+        forEachMismatchAvx2(tolerance, expected + begin, actual + begin, end - begin, onMismatch);
+      } else {
+        forEachMismatchScalar(tolerance, expected + begin, actual + begin, end - begin, onMismatch);
+      }
+#else
+      static_cast<void>(simd);
+      forEachMismatchScalar(tolerance, expected + begin, actual + begin, end - begin, onMismatch);
+#endif  // defined(CLSTUDY_HOST_AVX2)
+
+      std::lock_guard<std::mutex> lock{mutex};
+      nMismatches += localCount;
+      mismatches.insert(std::end(mismatches), std::begin(localMismatches), std::end(localMismatches));
+      isStoppedEarly |= isLocalStopped;
+    });
+
+    std::sort(std::begin(mismatches), std::end(mismatches), [](const auto& lhs, const auto& rhs) {
+      return lhs.index < rhs.index;
+    });
+    if (mismatches.size() > nSlots) {
+      mismatches.resize(nSlots);
+    }
+    m_report.nMismatches += nMismatches;
+    m_report.mismatches.insert(std::end(m_report.mismatches), std::begin(mismatches), std::end(mismatches));
+    m_report.isStoppedEarly = isStoppedEarly;
+    return nMismatches == 0;
+  }
+
+  /*!
+   * Verify the first n floats of buffer against expected, mapping chunkSize
+   * elements at a time for reading. The next chunk is mapped while the
+   * current one is compared. Waits for all commands of queue.
+   */
+  const VerifyReport&
+  verifyBuffer(
+    const cl::CommandQueue& queue,
+    const cl::Buffer& buffer,
+    const float* expected,
+    std::size_t n,
+    std::size_t chunkSize = kDefaultChunkSize)
+  {
+    reset();
+    if (n == 0) {
+      return m_report;
+    }
+
+    const auto mapChunk = [&](std::size_t offset, cl::Event& event) {
+      return static_cast<float*>(queue.enqueueMapBuffer(
+        buffer,
+        CL_FALSE,
+        CL_MAP_READ,
+        sizeof(float) * offset,
+        sizeof(float) * std::min(chunkSize, n - offset),
+        nullptr,
+        &event));
+    };
+    cl::Event event;
+    auto ptr = mapChunk(0, event);
+    for (std::size_t offset = 0; ; offset += chunkSize) {
+      const auto size = std::min(chunkSize, n - offset);
+      event.wait();
+      const auto isLast = offset + size >= n || isStopped();
+      cl::Event nextEvent;
+      float* nextPtr = nullptr;
+      if (!isLast) {
+        nextPtr = mapChunk(offset + size, nextEvent);
+        queue.flush();
+      }
+      verifyChunk(offset, expected + offset, ptr, size);
+      queue.enqueueUnmapMemObject(buffer, ptr);
+      if (isLast) {
+        break;
+      }
+      ptr = nextPtr;
+      event = nextEvent;
+    }
+    queue.finish();
+    return m_report;
+  }
+
+private:
+  HostCompute& m_hostCompute;
+  Tolerance m_tolerance;
+  std::size_t m_maxReported;
+  bool m_isStopEarly;
+  VerifyReport m_report;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_VERIFY_HPP
@@ -0,0 +1,360 @@
+#ifndef CLSTUDY_WORK_GROUP_TUNER_HPP
+#define CLSTUDY_WORK_GROUP_TUNER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <config/opencl.hpp>
+#include <clstudy/program_cache.hpp>
+
+
+namespace clstudy
+{
+
+/*!
+ * Picks the local size of 1-D kernels by measurement and remembers it.
+ *
+ * The first request for a (device, driver, kernel, tag, global size) runs the
+ * kernel with every candidate local size and keeps the fastest one; later
+ * requests, also in later runs, are answered from the database file.
+ *
+ * Candidates are the multiples of CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+ * by powers of two up to CL_KERNEL_WORK_GROUP_SIZE that divide the global size,
+ * plus the implementation's own choice (cl::NullRange), which is kept when no
+ * candidate beats it.
+ *
+ * For kernels written as grid-stride loops, getGridStrideRange() tunes the
+ * global size as well, as CL_DEVICE_MAX_COMPUTE_UNITS x occupancy factor
+ * work-groups.
+ *
+ * Tuning launches the kernel with the arguments already set on it, so the
+ * kernel must be safe to run repeatedly.
+ */
+class WorkGroupTuner
+{
+public:
+  // Format of a line:
+  //   <key> <local size> <occupancy factor> <kernel name> <global size>
+  // A local size of 0 stands for cl::NullRange, and the occupancy factor is 0
+  // for entries of getLocalSize().
+  explicit WorkGroupTuner(std::string dbPath = "workgroup.tune")
+    : m_dbPath(std::move(dbPath))
+    , m_entries()
+    , m_mutex()
+  {
+    load();
+  }
+
+  WorkGroupTuner(const WorkGroupTuner&) = delete;
+
+  WorkGroupTuner&
+  operator=(const WorkGroupTuner&) = delete;
+
+  /*!
+   * Local range to launch kernel with globalSize work-items on the device of
+   * queue. tag should identify the build of the kernel, e.g. its build options,
+   * when the same kernel name is built in several ways.
+   */
+  cl::NDRange
+  getLocalRange(
+    cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    std::size_t globalSize,
+    const std::string& tag = "")
+  {
+    const auto localSize = getLocalSize(queue, kernel, globalSize, tag);
+    return localSize == 0 ? cl::NullRange : cl::NDRange{localSize};
+  }
+
+  std::size_t
+  getLocalSize(
+    cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    std::size_t globalSize,
+    const std::string& tag = "")
+  {
+    const auto device = queue.getInfo<CL_QUEUE_DEVICE>();
+    const auto kernelName = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+    const auto key = calcKey(device, kernelName, tag, globalSize);
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      return it->second.localSize;
+    }
+
+    const auto localSize = tune(queue, kernel, device, globalSize);
+    m_entries[key] = Entry{localSize, 0, kernelName, globalSize};
+    save();
+    return localSize;
+  }
+
+  struct GridStrideRange
+  {
+    std::size_t globalSize;
+    std::size_t localSize;
+    std::size_t occupancyFactor;
+  };
+
+  /*!
+   * Launch size of a grid-stride kernel processing problemSize elements:
+   * CL_DEVICE_MAX_COMPUTE_UNITS x occupancyFactor work-groups of localSize,
+   * where both localSize and occupancyFactor are tuned.
+   */
+  GridStrideRange
+  getGridStrideRange(
+    cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    std::size_t problemSize,
+    const std::string& tag = "")
+  {
+    const auto device = queue.getInfo<CL_QUEUE_DEVICE>();
+    const auto kernelName = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+    const auto key = calcKey(device, kernelName, tag + "#grid-stride", problemSize);
+    const std::size_t nComputeUnits = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const auto it = m_entries.find(key);
+    if (it != m_entries.end() && it->second.occupancyFactor != 0) {
+      const auto& entry = it->second;
+      return {nComputeUnits * entry.occupancyFactor * entry.localSize, entry.localSize, entry.occupancyFactor};
+    }
+
+    const auto range = tuneGridStride(queue, kernel, device, problemSize);
+    m_entries[key] = Entry{range.localSize, range.occupancyFactor, kernelName, problemSize};
+    save();
+    return range;
+  }
+
+  // Enqueue kernel with the tuned local size.
+  cl::Event
+  enqueue(
+    cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    std::size_t globalSize,
+    const std::string& tag = "")
+  {
+    cl::Event event;
+    queue.enqueueNDRangeKernel(
+      kernel,
+      cl::NullRange,
+      cl::NDRange{globalSize},
+      getLocalRange(queue, kernel, globalSize, tag),
+      nullptr,
+      &event);
+    return event;
+  }
+
+  // With globalSize of 0, candidates are not restricted to its divisors.
+  static std::vector<std::size_t>
+  makeCandidates(
+    const cl::Kernel& kernel,
+    const cl::Device& device,
+    std::size_t globalSize = 0)
+  {
+    auto maxSize = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    const auto maxItemSizes = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+    if (!maxItemSizes.empty() && maxItemSizes[0] < maxSize) {
+      maxSize = maxItemSizes[0];
+    }
+    auto multiple = kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+    if (multiple == 0) {
+      multiple = 1;
+    }
+
+    std::vector<std::size_t> candidates;
+    for (auto size = multiple; size <= maxSize; size *= 2) {
+      // Before OpenCL 2.0 the global size has to be a multiple of the local size.
+      if (globalSize == 0 || globalSize % size == 0) {
+        candidates.push_back(size);
+      }
+    }
+    return candidates;
+  }
+
+private:
+  struct Entry
+  {
+    std::size_t localSize = 0;
+    std::size_t occupancyFactor = 0;
+    std::string kernelName = "";
+    std::size_t globalSize = 0;
+  };
+
+  static std::uint64_t
+  calcKey(
+    const cl::Device& device,
+    const std::string& kernelName,
+    const std::string& tag,
+    std::uint64_t globalSize)
+  {
+    const cl::Platform platform{device.getInfo<CL_DEVICE_PLATFORM>()};
+    return Fnv1aHasher{}
+      .update(platform.getInfo<CL_PLATFORM_NAME>())
+      .update(platform.getInfo<CL_PLATFORM_VERSION>())
+      .update(device.getInfo<CL_DEVICE_NAME>())
+      .update(device.getInfo<CL_DRIVER_VERSION>())
+      .update(kernelName)
+      .update(tag)
+      .update(globalSize)
+      .digest();
+  }
+
+  // Elapsed seconds of a few launches after a warm-up, or a negative value when
+  // the launch fails, e.g. with CL_OUT_OF_RESOURCES for a kernel using much
+  // local memory.
+  static double
+  measure(
+    cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    const cl::NDRange& globalRange,
+    const cl::NDRange& localRange)
+  {
+    constexpr auto kRepeats = 5;
+
+    try {
+      queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange);
+      queue.finish();
+      const auto start = std::chrono::high_resolution_clock::now();
+      for (int i = 0; i < kRepeats; i++) {
+        queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange);
+      }
+      queue.finish();
+      return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    } catch (const cl::Error& ex) {
+      std::cerr << "Launch configuration is not usable: "
+                << ex.what() << "(" << ex.err() << ")" << std::endl;
+      return -1.0;
+    }
+  }
+
+  static std::size_t
+  tune(
+    cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    const cl::Device& device,
+    std::size_t globalSize)
+  {
+    std::size_t bestSize = 0;
+    auto bestElapsed = measure(queue, kernel, cl::NDRange{globalSize}, cl::NullRange);
+    for (const auto size : makeCandidates(kernel, device, globalSize)) {
+      const auto elapsed = measure(queue, kernel, cl::NDRange{globalSize}, cl::NDRange{size});
+      if (elapsed >= 0.0 && (bestElapsed < 0.0 || elapsed < bestElapsed)) {
+        bestSize = size;
+        bestElapsed = elapsed;
+      }
+    }
+    return bestSize;
+  }
+
+  static GridStrideRange
+  tuneGridStride(
+    cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    const cl::Device& device,
+    std::size_t problemSize)
+  {
+    constexpr std::size_t kMaxOccupancyFactor = 64;
+
+    const std::size_t nComputeUnits = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    auto localSizes = makeCandidates(kernel, device);
+    if (localSizes.empty()) {
+      localSizes.push_back(1);
+    }
+
+    GridStrideRange best{nComputeUnits * localSizes[0], localSizes[0], 1};
+    auto bestElapsed = -1.0;
+    for (const auto localSize : localSizes) {
+      for (std::size_t factor = 1; factor <= kMaxOccupancyFactor; factor *= 2) {
+        const auto globalSize = nComputeUnits * factor * localSize;
+        const auto elapsed = measure(queue, kernel, cl::NDRange{globalSize}, cl::NDRange{localSize});
+        if (elapsed >= 0.0 && (bestElapsed < 0.0 || elapsed < bestElapsed)) {
+          best = GridStrideRange{globalSize, localSize, factor};
+          bestElapsed = elapsed;
+        }
+        // More work-items than elements would only idle.
+        if (globalSize >= problemSize) {
+          break;
+        }
+      }
+    }
+    return best;
+  }
+
+  void
+  load()
+  {
+    std::ifstream ifs{m_dbPath};
+    std::string line;
+    while (std::getline(ifs, line)) {
+      std::istringstream iss{line};
+      std::string keyStr;
+      Entry entry;
+      if (!(iss >> keyStr >> entry.localSize >> entry.occupancyFactor >> entry.kernelName >> entry.globalSize)) {
+        continue;
+      }
+      char* keyEnd = nullptr;
+      const auto key = std::strtoull(keyStr.c_str(), &keyEnd, 16);
+      if (keyEnd != keyStr.c_str() + keyStr.size()) {
+        continue;
+      }
+      m_entries[key] = entry;
+    }
+  }
+
+  // Rewrites the whole database through a temporary file, like the program
+  // cache, so that a concurrent reader never sees a partially written one.
+  void
+  save() const
+  {
+    std::random_device rd;
+    const auto tmpFilePath = m_dbPath + ".tmp" + toHexString((static_cast<std::uint64_t>(rd()) << 32) | rd());
+    {
+      std::ofstream ofs{tmpFilePath};
+      if (!ofs.is_open()) {
+        std::cerr << "Failed to open: " << tmpFilePath << std::endl;
+        return;
+      }
+      for (const auto& kv : m_entries) {
+        ofs << toHexString(kv.first) << " " << kv.second.localSize << " "
+            << kv.second.occupancyFactor << " " << kv.second.kernelName << " " << kv.second.globalSize << "\n";
+      }
+      if (!ofs.flush()) {
+        std::cerr << "Failed to write: " << tmpFilePath << std::endl;
+        ofs.close();
+        std::remove(tmpFilePath.c_str());
+        return;
+      }
+    }
+
+#ifdef _WIN32
+    // rename() on Windows does not replace an existing file.
+    std::remove(m_dbPath.c_str());
+#endif  // _WIN32
+    if (std::rename(tmpFilePath.c_str(), m_dbPath.c_str()) != 0) {
+      std::cerr << "Failed to rename: " << tmpFilePath << " -> " << m_dbPath << std::endl;
+      std::remove(tmpFilePath.c_str());
+    }
+  }
+
+  std::string m_dbPath;
+  std::map<std::uint64_t, Entry> m_entries;
+  std::mutex m_mutex;
+};
+
+}  // namespace clstudy
+
+
+#endif  // CLSTUDY_WORK_GROUP_TUNER_HPP